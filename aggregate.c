@@ -0,0 +1,345 @@
+/**
+ * @file aggregate.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief aggregation mode: tables of distinct objects instead of events
+ *
+ * Every process, file and socket seen by the hooks is kept once in
+ * a table with its hit count and the first/last hit time, so readers
+ * get the set of objects and nothing overflows.
+ *
+ * Hooks can't allocate nor take locks, so tables are preallocated and
+ * open addressed. A slot is written under its seqcount, readers retry
+ * on it, writers skip the slots being written. A new object takes an
+ * empty slot or evicts the least recently hit one within the probed
+ * slots. Concurrent first hits of an object may take two slots.
+ *
+ * /proc/rootkiticide_aggr dumps the tables as the binary stream,
+ * a LOG_SEEN record before the record of every object. Objects evicted
+ * from a table are counted in /proc/rootkiticide_stats, so a partial
+ * dump is told from a complete one.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/clock.h>
+#endif
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/jhash.h>
+#include <linux/string.h>
+
+#include "rootkiticide.h"
+
+bool aggregate = false;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate,
+		 "keep distinct processes, files and sockets in tables "
+		 "(/proc/rootkiticide_aggr) instead of logging every event");
+
+#define AGGR_SLOTS 4096		/* per table, must be a power of 2 */
+#define AGGR_PROBES 8		/* slots looked up before evicting */
+#define AGGR_NAME_MAX 256	/* longer filenames are logged as events */
+
+struct aggr_slot {
+	atomic_t seq;		/* odd while the object is written */
+	u32 hash;		/* of the key, 0 - empty slot */
+	atomic_t hits;
+	u64 first;		/* local_clock() */
+	atomic64_t last;
+	union {
+		struct log_entry common;
+		struct log_socket_entry socket;
+		struct {
+			struct log_file_entry file;
+			char filename[AGGR_NAME_MAX];
+		} __attribute__((packed));
+	} record;
+};
+
+/* indexed by enum log_type */
+static struct aggr_slot *aggr_tables[LOG_PROCESS + 1];
+static atomic_t aggr_evicted[LOG_PROCESS + 1];
+
+static const char *const aggr_table_names[] = {
+	[LOG_SOCKET] = "socket",
+	[LOG_FILE] = "file",
+	[LOG_PROCESS] = "process",
+};
+
+/**
+ * Count a hit of the object, the key are the last len bytes
+ * of its record starting at key_off.
+ */
+static void aggr_hit(const enum log_type type, const void *const key,
+		     const size_t key_off, const size_t len, const u32 cookie)
+{
+	struct aggr_slot *table = aggr_tables[type];
+	struct aggr_slot *slot, *victim = NULL;
+	u32 hash = jhash(key, len, type) ?: 1;
+	u32 seq, victim_seq = 0;
+	u64 now = local_clock();
+	int i;
+
+	for (i = 0; i < AGGR_PROBES; i++) {
+		slot = &table[(hash + i) & (AGGR_SLOTS - 1)];
+		seq = atomic_read(&slot->seq);
+		if (seq & 1)
+			continue;
+		smp_rmb();
+
+		if (slot->hash == hash && slot->record.common.size == key_off + len
+		    && !memcmp((void *)&slot->record + key_off, key, len)) {
+			smp_rmb();
+			if (atomic_read(&slot->seq) != seq)
+				continue;
+			atomic_inc(&slot->hits);
+			atomic64_set(&slot->last, now);
+			return;
+		}
+
+		/* the first empty slot or the least recently hit one */
+		if (!victim || (victim->hash && (!slot->hash ||
+		    atomic64_read(&slot->last) < atomic64_read(&victim->last)))) {
+			victim = slot;
+			victim_seq = seq;
+		}
+	}
+
+	/* lost to another writer, the object is counted on its next hit */
+	if (!victim || atomic_cmpxchg(&victim->seq, victim_seq, victim_seq + 1)
+			!= victim_seq)
+		return;
+
+	if (victim->hash)
+		atomic_inc(&aggr_evicted[type]);
+
+	victim->record.common.size = key_off + len;
+	victim->record.common.type = type;
+	victim->record.common.reserved = 0;
+	/* not a record of the stream, ts is the last hit when read */
+	victim->record.common.seq = 0;
+	victim->record.common.ts = now;
+	victim->record.common.cpu = raw_smp_processor_id();
+	victim->record.common.pid = current->pid;
+	victim->record.common.tgid = current->tgid;
+	memcpy(victim->record.common.comm, current->comm,
+	       sizeof(victim->record.common.comm));
+	/* file and socket records start with the cookie */
+	if (type != LOG_PROCESS)
+		victim->record.file.cookie = cookie;
+	memcpy((void *)&victim->record + key_off, key, len);
+
+	victim->hash = hash;
+	victim->first = now;
+	atomic64_set(&victim->last, now);
+	atomic_set(&victim->hits, 1);
+	smp_wmb();
+	atomic_set(&victim->seq, victim_seq + 2);
+}
+
+int __must_check aggr_process(void)
+{
+	struct log_entry key;
+
+	/* the whole record after cpu is the key */
+	key.pid = current->pid;
+	key.tgid = current->tgid;
+	memcpy(key.comm, current->comm, sizeof(key.comm));
+
+	aggr_hit(LOG_PROCESS, &key.pid, offsetof(struct log_entry, pid),
+		 sizeof(key) - offsetof(struct log_entry, pid), 0);
+	return 0;
+}
+
+int __must_check aggr_file(const char *const filename, const size_t len,
+			   const u32 cookie)
+{
+	if (len >= AGGR_NAME_MAX)
+		return -ENAMETOOLONG;
+
+	/* the terminating null is a part of the key */
+	aggr_hit(LOG_FILE, filename, offsetof(struct log_file_entry, filename),
+		 len + 1, cookie);
+	return 0;
+}
+
+int __must_check aggr_socket(const struct sockaddr_storage *const saddr,
+			     const size_t len, const u32 cookie)
+{
+	aggr_hit(LOG_SOCKET, saddr, offsetof(struct log_socket_entry, saddr),
+		 len, cookie);
+	return 0;
+}
+
+/* consistent copy of a slot, false if it is empty */
+static bool aggr_read_slot(struct aggr_slot *slot, struct log_seen_entry *seen,
+			   typeof(slot->record) *record)
+{
+	u32 seq;
+
+	do {
+		seq = atomic_read(&slot->seq);
+		if (seq & 1) {
+			cpu_relax();
+			continue;
+		}
+		smp_rmb();
+
+		if (!slot->hash)
+			return false;
+
+		memcpy(record, &slot->record, min_t(size_t, sizeof(*record),
+						    slot->record.common.size));
+		seen->hits = atomic_read(&slot->hits);
+		seen->first = slot->first;
+		seen->last = atomic64_read(&slot->last);
+		smp_rmb();
+	} while ((seq & 1) || atomic_read(&slot->seq) != seq);
+
+	record->common.ts = seen->last;
+	seen->common = record->common;
+	seen->common.size = sizeof(*seen);
+	seen->common.type = LOG_SEEN;
+	return true;
+}
+
+/* objects evicted from the tables since load */
+void aggr_stats(struct seq_file *s)
+{
+	int type;
+
+	if (!aggregate)
+		return;
+
+	seq_printf(s, "\ntable\tevicted\n");
+	for (type = 0; type <= LOG_PROCESS; type++)
+		seq_printf(s, "%s\t%d\n", aggr_table_names[type],
+			   atomic_read(&aggr_evicted[type]));
+}
+
+/* position in the tables, the stream header is emitted at zero */
+struct aggr_reader_state {
+	int type;
+	int slot;
+};
+
+static ssize_t aggr_read(struct file *file, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	struct aggr_reader_state *state = file->private_data;
+	struct log_seen_entry seen;
+	typeof(aggr_tables[0]->record) record;
+	size_t done = 0;
+
+	if (!*ppos) {
+		if (count < sizeof(log_stream_header))
+			return -EINVAL;
+		if (copy_to_user(buf, &log_stream_header,
+				 sizeof(log_stream_header)))
+			return -EFAULT;
+		done = sizeof(log_stream_header);
+	}
+
+	for (; state->type <= LOG_PROCESS; state->type++, state->slot = 0) {
+		for (; state->slot < AGGR_SLOTS; state->slot++) {
+			if (!aggr_read_slot(&aggr_tables[state->type][state->slot],
+					    &seen, &record))
+				continue;
+
+			if (done + seen.common.size + record.common.size > count) {
+				/* the buffer must fit at least one object */
+				if (!done)
+					return -EINVAL;
+				goto out;
+			}
+
+			if (copy_to_user(buf + done, &seen, sizeof(seen)) ||
+			    copy_to_user(buf + done + sizeof(seen), &record,
+					 record.common.size)) {
+				if (!done)
+					return -EFAULT;
+				goto out;
+			}
+
+			done += sizeof(seen) + record.common.size;
+		}
+	}
+
+out:
+	*ppos += done;
+	return done;
+}
+
+static int aggr_open(struct inode *inode, struct file *file)
+{
+	int ret = reader_acquire(file, false);
+	if (ret)
+		return ret;
+
+	file->private_data = kzalloc(sizeof(struct aggr_reader_state),
+				     GFP_KERNEL);
+	if (!file->private_data) {
+		reader_release(file, false);
+		return -ENOMEM;
+	}
+
+	return nonseekable_open(inode, file);
+}
+
+static int aggr_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	reader_release(file, false);
+	return 0;
+}
+
+static const struct file_operations aggr_fops = {
+	.owner = THIS_MODULE,
+	.open = aggr_open,
+	.read = aggr_read,
+	.llseek = no_llseek,
+	.release = aggr_release,
+};
+
+int __must_check aggr_init(void)
+{
+	int type;
+
+	if (!aggregate)
+		return 0;
+
+	for (type = 0; type <= LOG_PROCESS; type++) {
+		aggr_tables[type] = vzalloc(AGGR_SLOTS * sizeof(struct aggr_slot));
+		if (!aggr_tables[type])
+			goto err;
+	}
+
+	if (!proc_create(PROCNAME "_aggr", 0400, NULL, &aggr_fops))
+		goto err;
+
+	return 0;
+
+err:
+	for (type = 0; type <= LOG_PROCESS; type++)
+		vfree(aggr_tables[type]);
+	return -ENOMEM;
+}
+
+void aggr_cleanup(void)
+{
+	int type;
+
+	if (!aggregate)
+		return;
+
+	remove_proc_entry(PROCNAME "_aggr", NULL);
+	for (type = 0; type <= LOG_PROCESS; type++)
+		vfree(aggr_tables[type]);
+}
@@ -0,0 +1,15 @@
+#!/bin/sh -eu
+# Overhead of the hook backends, run as root in the test vm (make vm-bench)
+ITERATIONS=${1:-1000000}
+
+for backend in none hbp kprobe ftrace; do
+	rmmod rkcd 2>/dev/null || true
+	if [ $backend != none ] && ! insmod ./rkcd.ko hook_backend=$backend; then
+		printf "%s\tunavailable\n" $backend
+		continue
+	fi
+
+	./hookbench $ITERATIONS | sed "s/^/$backend\t/"
+done
+
+rmmod rkcd 2>/dev/null || true
@@ -0,0 +1,670 @@
+/**
+ * @file capture.go
+ * @author Mikhail Klementyev jollheef<AT>riseup.net
+ * @date October 2026
+ * @brief append-only capture of the events and its replay
+ *
+ * A capture is a sequence of self-contained blocks, each of them is
+ * a fixed header followed by three deflated sections:
+ *
+ *	strings  comms, paths and addresses first seen in the block,
+ *	         numbered after the ones of the previous blocks
+ *	index    pids and string ids the records refer to
+ *	records  varint encoded records referring to strings by id
+ *
+ * Headers hold the time range of the block, so a replay reads the
+ * headers, inflates the index and the records of the blocks that may
+ * match and the strings of the blocks defining the ids it prints only.
+ * Blocks are only appended, a torn last block (e.g. after a crash) is
+ * cut off when the capture is opened for writing again.
+ */
+
+package main
+
+import (
+	"bytes"
+	"compress/flate"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"os"
+	"sort"
+	"strings"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+const (
+	captureMagic   = 0x63636b72 // "rkcc"
+	captureVersion = 1
+
+	captureBlockRecords = 4096
+	captureBlockAge     = time.Minute // of the oldest pending record
+)
+
+const (
+	sectionStrings = iota
+	sectionIndex
+	sectionRecords
+	sections
+)
+
+type captureHeader struct {
+	Magic       uint32
+	Version     uint16
+	Reserved    uint16
+	Count       uint32 // records
+	Boot        int64  // wall clock at zero of the kernel clock, ns
+	MinTS       uint64
+	MaxTS       uint64
+	FirstString uint32 // id of the first string of the block
+	Strings     uint32
+	Len         [sections]uint32 // of the deflated sections
+	CRC         [sections]uint32
+}
+
+var captureHeaderSize = int64(binary.Size(captureHeader{}))
+
+var errCorruptCapture = errors.New("corrupt capture")
+
+type captureBlock struct {
+	captureHeader
+	offset int64 // of the first section
+}
+
+func (block *captureBlock) matchTime(from, to time.Time) bool {
+	first := time.Unix(0, block.Boot+int64(block.MinTS))
+	last := time.Unix(0, block.Boot+int64(block.MaxTS))
+	return (from.IsZero() || !last.Before(from)) &&
+		(to.IsZero() || !first.After(to))
+}
+
+func (block *captureBlock) end() int64 {
+	end := block.offset
+	for _, n := range block.Len {
+		end += int64(n)
+	}
+	return end
+}
+
+// monotonicNow is the clock local_clock() of the kernel follows closely
+func monotonicNow() int64 {
+	var ts syscall.Timespec
+	// CLOCK_MONOTONIC
+	syscall.Syscall(syscall.SYS_CLOCK_GETTIME, 1,
+		uintptr(unsafe.Pointer(&ts)), 0)
+	return ts.Nano()
+}
+
+func deflate(data []byte) (out []byte) {
+	var buf bytes.Buffer
+	writer, _ := flate.NewWriter(&buf, flate.DefaultCompression)
+	writer.Write(data)
+	writer.Close()
+	return buf.Bytes()
+}
+
+type varintWriter struct {
+	bytes.Buffer
+	tmp [binary.MaxVarintLen64]byte
+}
+
+func (w *varintWriter) put(v uint64) {
+	w.Write(w.tmp[:binary.PutUvarint(w.tmp[:], v)])
+}
+
+func (w *varintWriter) putString(s string) {
+	w.put(uint64(len(s)))
+	w.WriteString(s)
+}
+
+// putSet writes sorted ids as deltas
+func (w *varintWriter) putSet(set map[uint32]bool) {
+	ids := make([]uint32, 0, len(set))
+	for id := range set {
+		ids = append(ids, id)
+	}
+	sort.Slice(ids, func(i, j int) bool { return ids[i] < ids[j] })
+
+	w.put(uint64(len(ids)))
+	var prev uint32
+	for _, id := range ids {
+		w.put(uint64(id - prev))
+		prev = id
+	}
+}
+
+type varintReader struct {
+	*bytes.Reader
+	err error
+}
+
+func (r *varintReader) get() (v uint64) {
+	if r.err == nil {
+		v, r.err = binary.ReadUvarint(r)
+	}
+	return
+}
+
+func (r *varintReader) getByte() (v uint8) {
+	if r.err == nil {
+		v, r.err = r.ReadByte()
+	}
+	return
+}
+
+func (r *varintReader) getString() string {
+	n := r.get()
+	if r.err != nil || n > uint64(r.Len()) {
+		r.err = errCorruptCapture
+		return ""
+	}
+	buf := make([]byte, n)
+	io.ReadFull(r, buf)
+	return string(buf)
+}
+
+func (r *varintReader) getSet() (set map[uint32]bool) {
+	set = map[uint32]bool{}
+	var id uint32
+	for n := r.get(); n > 0 && r.err == nil; n-- {
+		id += uint32(r.get())
+		set[id] = true
+	}
+	return
+}
+
+// captureFile reads blocks of a capture
+type captureFile struct {
+	file    *os.File
+	blocks  []captureBlock
+	strings map[int][]string // of the blocks inflated so far
+}
+
+// scan reads block headers up to the first incomplete block, the last
+// block is checked as a whole as it is the one that may be torn
+func (c *captureFile) scan() (end int64, err error) {
+	size, err := c.file.Seek(0, io.SeekEnd)
+	if err != nil {
+		return
+	}
+
+	for end+captureHeaderSize <= size {
+		var block captureBlock
+		reader := io.NewSectionReader(c.file, end, captureHeaderSize)
+		err = binary.Read(reader, binary.LittleEndian,
+			&block.captureHeader)
+		if err != nil {
+			return
+		}
+		block.offset = end + captureHeaderSize
+
+		if block.Magic != captureMagic ||
+			block.Version != captureVersion || block.end() > size {
+			break
+		}
+		c.blocks = append(c.blocks, block)
+		end = block.end()
+	}
+
+	if n := len(c.blocks); n > 0 {
+		for section := 0; section < sections; section++ {
+			if _, err = c.section(n-1, section); err != nil {
+				end = c.blocks[n-1].offset - captureHeaderSize
+				c.blocks = c.blocks[:n-1]
+				err = nil
+				break
+			}
+		}
+	}
+	return
+}
+
+func (c *captureFile) section(i, section int) (data []byte, err error) {
+	block := &c.blocks[i]
+	offset := block.offset
+	for s := 0; s < section; s++ {
+		offset += int64(block.Len[s])
+	}
+
+	raw := make([]byte, block.Len[section])
+	_, err = c.file.ReadAt(raw, offset)
+	if err != nil {
+		return
+	}
+	if crc32.ChecksumIEEE(raw) != block.CRC[section] {
+		err = errCorruptCapture
+		return
+	}
+
+	return io.ReadAll(flate.NewReader(bytes.NewReader(raw)))
+}
+
+func (c *captureFile) blockStrings(i int) (strs []string, err error) {
+	if strs, ok := c.strings[i]; ok {
+		return strs, nil
+	}
+
+	data, err := c.section(i, sectionStrings)
+	if err != nil {
+		return
+	}
+
+	reader := varintReader{Reader: bytes.NewReader(data)}
+	for n := c.blocks[i].Strings; n > 0 && reader.err == nil; n-- {
+		strs = append(strs, reader.getString())
+	}
+	if reader.err != nil {
+		return nil, errCorruptCapture
+	}
+
+	c.strings[i] = strs
+	return
+}
+
+// lookup inflates the strings of the block defining the id only
+func (c *captureFile) lookup(id uint32) (s string, err error) {
+	i := sort.Search(len(c.blocks), func(i int) bool {
+		return c.blocks[i].FirstString+c.blocks[i].Strings > id
+	})
+	if i == len(c.blocks) || c.blocks[i].FirstString > id {
+		return "", errCorruptCapture
+	}
+
+	strs, err := c.blockStrings(i)
+	if err != nil {
+		return
+	}
+	return strs[id-c.blocks[i].FirstString], nil
+}
+
+func (c *captureFile) stringCount() uint32 {
+	if len(c.blocks) == 0 {
+		return 0
+	}
+	last := c.blocks[len(c.blocks)-1]
+	return last.FirstString + last.Strings
+}
+
+func openCaptureFile(path string, flag int) (c *captureFile, end int64,
+	err error) {
+
+	file, err := os.OpenFile(path, flag, 0600)
+	if err != nil {
+		return
+	}
+
+	c = &captureFile{file: file, strings: map[int][]string{}}
+	end, err = c.scan()
+	if err != nil {
+		file.Close()
+	}
+	return
+}
+
+// captureWriter appends events to a capture in blocks
+type captureWriter struct {
+	*captureFile
+	ids     map[string]uint32
+	pending []logEntry
+	since   time.Time // of the oldest pending record
+}
+
+func openCapture(path string) (w *captureWriter, err error) {
+	c, end, err := openCaptureFile(path, os.O_RDWR|os.O_CREATE)
+	if err != nil {
+		return
+	}
+
+	w = &captureWriter{captureFile: c, ids: map[string]uint32{}}
+	for i := range c.blocks {
+		var strs []string
+		strs, err = c.blockStrings(i)
+		if err != nil {
+			c.file.Close()
+			return
+		}
+		for j, s := range strs {
+			w.ids[s] = c.blocks[i].FirstString + uint32(j)
+		}
+	}
+	c.strings = map[int][]string{}
+
+	// cut off a torn block
+	if err = c.file.Truncate(end); err == nil {
+		_, err = c.file.Seek(end, io.SeekStart)
+	}
+	if err != nil {
+		c.file.Close()
+	}
+	return
+}
+
+func (w *captureWriter) add(entry logEntry) (err error) {
+	if len(w.pending) == 0 {
+		w.since = time.Now()
+	}
+	w.pending = append(w.pending, entry)
+	if len(w.pending) >= captureBlockRecords {
+		err = w.flush()
+	}
+	return
+}
+
+// tick writes out records pending for too long
+func (w *captureWriter) tick() (err error) {
+	if len(w.pending) != 0 && time.Since(w.since) >= captureBlockAge {
+		err = w.flush()
+	}
+	return
+}
+
+func (w *captureWriter) flush() (err error) {
+	if len(w.pending) == 0 {
+		return
+	}
+
+	block := captureHeader{
+		Magic:       captureMagic,
+		Version:     captureVersion,
+		Count:       uint32(len(w.pending)),
+		Boot:        time.Now().UnixNano() - monotonicNow(),
+		MinTS:       w.pending[0].TS,
+		FirstString: w.stringCount(),
+	}
+	for _, entry := range w.pending {
+		if entry.TS < block.MinTS {
+			block.MinTS = entry.TS
+		}
+		if entry.TS > block.MaxTS {
+			block.MaxTS = entry.TS
+		}
+	}
+
+	var strs, index, records varintWriter
+	pids := map[uint32]bool{}
+	ids := map[uint32]bool{}
+	fresh := map[string]uint32{} // known once the block is written
+
+	intern := func(s string) uint32 {
+		id, ok := w.ids[s]
+		if !ok {
+			id, ok = fresh[s]
+		}
+		if !ok {
+			id = block.FirstString + block.Strings
+			fresh[s] = id
+			block.Strings++
+			strs.putString(s)
+		}
+		ids[id] = true
+		records.put(uint64(id))
+		return id
+	}
+
+	for _, entry := range w.pending {
+		t := 0
+		for t < len(logTypeNames) && logTypeNames[t] != entry.Type {
+			t++
+		}
+		records.WriteByte(byte(t))
+		records.put(uint64(entry.CPU))
+		records.put(uint64(entry.Seq))
+		records.put(entry.TS - block.MinTS)
+		records.put(uint64(uint32(entry.PID)))
+		records.put(uint64(uint32(entry.TGID)))
+		pids[uint32(entry.PID)] = true
+		pids[uint32(entry.TGID)] = true
+		intern(entry.Comm)
+
+		switch t {
+		case logSocket:
+			records.put(uint64(entry.Cookie))
+			intern(entry.Saddr)
+		case logFile:
+			records.put(uint64(entry.Cookie))
+			intern(entry.Filename)
+		case logRepeat:
+			records.put(uint64(entry.Cookie))
+			records.put(uint64(entry.Count))
+			records.put(uint64(uint32(entry.RepeatTGID)))
+			intern(entry.RepeatType)
+		case logSeen:
+			records.put(uint64(entry.Hits))
+			records.put(entry.First)
+			records.put(entry.Last)
+		case logHidden:
+			records.WriteByte(entry.Missing)
+		case logSampling:
+			records.WriteByte(entry.Level)
+			records.put(uint64(entry.Skipped))
+			records.put(uint64(entry.Load))
+			intern(entry.Hook)
+		case logWatch:
+			intern(entry.Hook)
+		}
+	}
+
+	index.putSet(pids)
+	index.putSet(ids)
+
+	var buf bytes.Buffer
+	data := [sections][]byte{deflate(strs.Bytes()), deflate(index.Bytes()),
+		deflate(records.Bytes())}
+	for section := range data {
+		block.Len[section] = uint32(len(data[section]))
+		block.CRC[section] = crc32.ChecksumIEEE(data[section])
+	}
+	binary.Write(&buf, binary.LittleEndian, &block)
+	for section := range data {
+		buf.Write(data[section])
+	}
+
+	end, err := w.file.Seek(0, io.SeekCurrent)
+	if err != nil {
+		return
+	}
+	if _, err = w.file.Write(buf.Bytes()); err != nil {
+		// drop the partial block, the records stay pending
+		if w.file.Truncate(end) == nil {
+			w.file.Seek(end, io.SeekStart)
+		}
+		return
+	}
+
+	for s, id := range fresh {
+		w.ids[s] = id
+	}
+	w.blocks = append(w.blocks, captureBlock{captureHeader: block,
+		offset: end + captureHeaderSize})
+	w.pending = w.pending[:0]
+	return
+}
+
+func (w *captureWriter) close() (err error) {
+	err = w.flush()
+	if cerr := w.file.Close(); err == nil {
+		err = cerr
+	}
+	return
+}
+
+type replayQuery struct {
+	from, to time.Time // zero - unbounded
+	pid      int       // pid or tgid, 0 - any
+	path     string    // prefix of the file, "" - any
+}
+
+// decodeCaptured decodes a record of the block, strings are left as ids
+func decodeCaptured(reader *varintReader, block *captureBlock) (
+	entry logEntry, ids []uint32) {
+
+	id := func() uint32 {
+		v := uint32(reader.get())
+		ids = append(ids, v)
+		return v
+	}
+
+	t, err := reader.ReadByte()
+	if err != nil || int(t) >= len(logTypeNames) {
+		reader.err = errCorruptCapture
+		return
+	}
+	entry.Type = logTypeNames[t]
+	entry.CPU = int(reader.get())
+	entry.Seq = uint32(reader.get())
+	entry.TS = block.MinTS + reader.get()
+	entry.PID = int(int32(reader.get()))
+	entry.TGID = int(int32(reader.get()))
+	id()
+
+	switch t {
+	case logSocket, logFile:
+		entry.Cookie = uint32(reader.get())
+		id()
+	case logRepeat:
+		entry.Cookie = uint32(reader.get())
+		entry.Count = uint32(reader.get())
+		entry.RepeatTGID = int(int32(reader.get()))
+		id()
+	case logSeen:
+		entry.Hits = uint32(reader.get())
+		entry.First = reader.get()
+		entry.Last = reader.get()
+	case logHidden:
+		entry.Missing = reader.getByte()
+	case logSampling:
+		entry.Level = reader.getByte()
+		entry.Skipped = uint32(reader.get())
+		entry.Load = uint32(reader.get())
+		id()
+	case logWatch:
+		id()
+	}
+	return
+}
+
+// replay calls handle for the captured records matching the query
+func replay(path string, query replayQuery,
+	handle func(time.Time, logEntry)) (err error) {
+
+	c, _, err := openCaptureFile(path, os.O_RDONLY)
+	if err != nil {
+		return
+	}
+	defer c.file.Close()
+
+	// all strings are needed to find the paths
+	var paths map[uint32]bool
+	if query.path != "" {
+		paths = map[uint32]bool{}
+		for i := range c.blocks {
+			var strs []string
+			if strs, err = c.blockStrings(i); err != nil {
+				return
+			}
+			for j, s := range strs {
+				if strings.HasPrefix(s, query.path) {
+					paths[c.blocks[i].FirstString+uint32(j)] = true
+				}
+			}
+		}
+		if len(paths) == 0 {
+			return
+		}
+	}
+
+	for i := range c.blocks {
+		block := &c.blocks[i]
+		if !block.matchTime(query.from, query.to) {
+			continue
+		}
+
+		if query.pid != 0 || paths != nil {
+			var data []byte
+			if data, err = c.section(i, sectionIndex); err != nil {
+				return
+			}
+			reader := varintReader{Reader: bytes.NewReader(data)}
+			pids, ids := reader.getSet(), reader.getSet()
+			if reader.err != nil {
+				return errCorruptCapture
+			}
+			if query.pid != 0 && !pids[uint32(query.pid)] {
+				continue
+			}
+			if paths != nil && !anyOf(ids, paths) {
+				continue
+			}
+		}
+
+		if err = replayBlock(c, i, query, paths, handle); err != nil {
+			return
+		}
+	}
+	return
+}
+
+func anyOf(set, of map[uint32]bool) bool {
+	for id := range of {
+		if set[id] {
+			return true
+		}
+	}
+	return false
+}
+
+func replayBlock(c *captureFile, i int, query replayQuery,
+	paths map[uint32]bool, handle func(time.Time, logEntry)) (err error) {
+
+	block := &c.blocks[i]
+	data, err := c.section(i, sectionRecords)
+	if err != nil {
+		return
+	}
+
+	reader := varintReader{Reader: bytes.NewReader(data)}
+	for n := block.Count; n > 0; n-- {
+		entry, ids := decodeCaptured(&reader, block)
+		if reader.err != nil {
+			return fmt.Errorf("block %d: %v", i, reader.err)
+		}
+
+		at := time.Unix(0, block.Boot+int64(entry.TS))
+		if (!query.from.IsZero() && at.Before(query.from)) ||
+			(!query.to.IsZero() && at.After(query.to)) {
+			continue
+		}
+		if query.pid != 0 && entry.PID != query.pid &&
+			entry.TGID != query.pid {
+			continue
+		}
+		if paths != nil && (entry.Type != "file" || !paths[ids[1]]) {
+			continue
+		}
+
+		var strs [2]string
+		for j, id := range ids {
+			if strs[j], err = c.lookup(id); err != nil {
+				return
+			}
+		}
+		entry.Comm = strs[0]
+		switch entry.Type {
+		case "socket":
+			entry.Saddr = strs[1]
+		case "file":
+			entry.Filename = strs[1]
+		case "repeat":
+			entry.RepeatType = strs[1]
+		case "sampling", "watch":
+			entry.Hook = strs[1]
+		}
+
+		handle(at, entry)
+	}
+	return
+}
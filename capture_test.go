@@ -0,0 +1,184 @@
+/**
+ * @file capture_test.go
+ * @author Mikhail Klementyev jollheef<AT>riseup.net
+ * @date October 2026
+ * @brief tests of the capture format, run with make cli-test
+ */
+
+package main
+
+import (
+	"io"
+	"os"
+	"path/filepath"
+	"reflect"
+	"testing"
+	"time"
+)
+
+func testEntries(ts uint64) []logEntry {
+	return []logEntry{
+		{Seq: 1, TS: ts, CPU: 0, Type: "process", PID: 10, TGID: 10,
+			Comm: "init"},
+		{Seq: 2, TS: ts + 1, CPU: 1, Type: "file", PID: 11, TGID: 10,
+			Comm: "sh", Cookie: 7, Filename: "/tmp/x"},
+		{Seq: 3, TS: ts + 2, CPU: 1, Type: "socket", PID: 20, TGID: 20,
+			Comm: "nc", Cookie: 8, Saddr: "10.0.0.1:4444"},
+		{Seq: 4, TS: ts + 3, CPU: 0, Type: "repeat", PID: 11, TGID: 10,
+			Comm: "sh", Cookie: 7, Count: 5, RepeatTGID: 10,
+			RepeatType: "file"},
+		{Seq: 5, TS: ts + 4, CPU: 2, Type: "sampling", PID: 30,
+			TGID: 30, Comm: "dd", Hook: "__vfs_write", Level: 2,
+			Skipped: 100, Load: 70},
+		{Seq: 6, TS: ts + 5, CPU: 2, Type: "file", PID: 30, TGID: 30,
+			Comm: "dd", Cookie: 9, Filename: "/var/log/y"},
+		{Seq: 7, TS: ts + 6, CPU: 0, Type: "watch", PID: 40, TGID: 40,
+			Comm: "insmod", Hook: "do_init_module"},
+	}
+}
+
+func writeCapture(t *testing.T, path string, blocks ...[]logEntry) {
+	w, err := openCapture(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, block := range blocks {
+		for _, entry := range block {
+			if err = w.add(entry); err != nil {
+				t.Fatal(err)
+			}
+		}
+		if err = w.flush(); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if err = w.close(); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func replayAll(t *testing.T, path string, query replayQuery) (
+	entries []logEntry) {
+
+	err := replay(path, query, func(at time.Time, entry logEntry) {
+		entries = append(entries, entry)
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	return
+}
+
+func TestCaptureRoundTrip(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "rkcd.cap")
+	first, second := testEntries(1000), testEntries(2000)
+	writeCapture(t, path, first, second)
+
+	got := replayAll(t, path, replayQuery{})
+	if want := append(first, second...); !reflect.DeepEqual(got, want) {
+		t.Fatalf("replayed %+v, want %+v", got, want)
+	}
+}
+
+func TestCaptureQuery(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "rkcd.cap")
+	entries := testEntries(1000)
+	writeCapture(t, path, entries)
+
+	got := replayAll(t, path, replayQuery{pid: 10})
+	if want := []logEntry{entries[0], entries[1], entries[3]}; !reflect.DeepEqual(got, want) {
+		t.Fatalf("by pid %+v, want %+v", got, want)
+	}
+
+	got = replayAll(t, path, replayQuery{path: "/var/"})
+	if want := []logEntry{entries[5]}; !reflect.DeepEqual(got, want) {
+		t.Fatalf("by path %+v, want %+v", got, want)
+	}
+
+	if got = replayAll(t, path, replayQuery{path: "/nowhere"}); got != nil {
+		t.Fatalf("unknown path matched %+v", got)
+	}
+}
+
+func TestCaptureTornTail(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "rkcd.cap")
+	first, second := testEntries(1000), testEntries(2000)
+	writeCapture(t, path, first, second)
+
+	info, err := os.Stat(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err = os.Truncate(path, info.Size()-10); err != nil {
+		t.Fatal(err)
+	}
+
+	if got := replayAll(t, path, replayQuery{}); !reflect.DeepEqual(got, first) {
+		t.Fatalf("torn capture replayed %+v, want %+v", got, first)
+	}
+
+	// reopening cuts the torn block off, appended blocks follow
+	third := testEntries(3000)
+	writeCapture(t, path, third)
+	got := replayAll(t, path, replayQuery{})
+	if want := append(first, third...); !reflect.DeepEqual(got, want) {
+		t.Fatalf("appended %+v, want %+v", got, want)
+	}
+}
+
+func TestCaptureFailedFlush(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "rkcd.cap")
+	first, second := testEntries(1000), testEntries(2000)
+	second[1].Filename = "/tmp/new"
+
+	w, err := openCapture(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, entry := range first {
+		if err = w.add(entry); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if err = w.flush(); err != nil {
+		t.Fatal(err)
+	}
+
+	// a read-only file fails the write of the next block
+	end, err := w.file.Seek(0, io.SeekCurrent)
+	if err != nil {
+		t.Fatal(err)
+	}
+	w.file.Close()
+	if w.file, err = os.Open(path); err != nil {
+		t.Fatal(err)
+	}
+	if _, err = w.file.Seek(end, io.SeekStart); err != nil {
+		t.Fatal(err)
+	}
+	for _, entry := range second {
+		if err = w.add(entry); err != nil {
+			t.Fatal(err)
+		}
+	}
+	if err = w.flush(); err == nil {
+		t.Fatal("flush to a read-only file succeeded")
+	}
+
+	// the strings of the failed block are written with the next one
+	w.file.Close()
+	if w.file, err = os.OpenFile(path, os.O_RDWR, 0); err != nil {
+		t.Fatal(err)
+	}
+	if _, err = w.file.Seek(end, io.SeekStart); err != nil {
+		t.Fatal(err)
+	}
+	if err = w.close(); err != nil {
+		t.Fatal(err)
+	}
+
+	got := replayAll(t, path, replayQuery{})
+	if want := append(first, second...); !reflect.DeepEqual(got, want) {
+		t.Fatalf("replayed %+v, want %+v", got, want)
+	}
+}
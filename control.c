@@ -0,0 +1,380 @@
+/**
+ * @file control.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief arming and disarming of the hooks at runtime
+ *
+ * Hooks are registered here by their owners and switched through
+ * /proc/rootkiticide_hooks, one command per line:
+ *
+ *	on <function>		arm a registered hook
+ *	off <function>		disarm it, the handler is not called
+ *	watch <function>	log the calls of the function (LOG_WATCH)
+ *	unwatch <function>	drop a watch
+ *
+ * Reading the file lists the hooks and their state. The ring and the
+ * aggregation tables are left alone, so e.g. the fd hooks can be armed
+ * only for an investigation window without losing what was logged.
+ * Hooks listed in the disarmed parameter are registered disarmed.
+ *
+ * Required hooks (the scheduler ones, crossview and the reader trees
+ * depend on them) can't be disarmed. Watching a function the handlers
+ * call would recurse, hook_call drops such hits and the known ones are
+ * refused.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/kallsyms.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#include "rootkiticide.h"
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,19,0)
+/* only the core of a module before the init part was added to it */
+#define within_module(addr, mod) within_module_core(addr, mod)
+#endif
+
+#define CONTROL_HOOKS_MAX 16
+#define CONTROL_TEXT_MAX PAGE_SIZE
+
+static char *disarmed = "";
+module_param(disarmed, charp, 0444);
+MODULE_PARM_DESC(disarmed,
+		 "comma separated functions whose hooks start disarmed "
+		 "(e.g. __vfs_write,vfs_writev)");
+
+struct control_hook {
+	char funcname[KSYM_NAME_LEN];	/* empty - free slot */
+	hook_handler_t handler;
+	enum latency_hook latency;
+	bool watch;			/* added through the control file */
+	bool required;			/* can't be disarmed */
+	bool no_hbp;			/* kprobe instead of a debug register */
+	struct hook *hook;		/* NULL - disarmed */
+};
+
+static struct control_hook control_hooks[CONTROL_HOOKS_MAX];
+static DEFINE_MUTEX(control_lock);
+
+/*
+ * Functions on the path of the handlers, of the hook backends included.
+ * hook_call drops the hits of a watch on them anyway, the list only
+ * refuses such a watch up front instead of leaving it silent.
+ */
+static const char *const control_denied[] = {
+	"memcpy", "memset", "memcmp", "strlen", "strnlen", "local_clock",
+	"sched_clock", "native_sched_clock", "irq_work_queue",
+	"arch_irq_work_raise", "d_path", "iterate_fd", "find_pid_ns",
+	"pid_task", "__rcu_read_lock", "__rcu_read_unlock", "_raw_spin_lock",
+	"_raw_spin_unlock", "notify_die",
+};
+
+static const char *const control_denied_prefixes[] = {
+	"perf_", "hw_breakpoint", "kprobe", "ftrace", "exc_", "do_debug",
+	"do_int3", "rcu_", "native_apic", "x2apic", "default_send_IPI",
+};
+
+/* the slot is kept while the hook is armed */
+static void control_watch_handler(struct pt_regs *regs, void *data)
+{
+	const struct control_hook *ch = data;
+
+	if (governor_admit())
+		WARN_ON(log_watch(ch->funcname));
+}
+
+static int __must_check control_watchable(const char *const funcname)
+{
+	ulong addr = kallsyms_lookup_name(funcname);
+	uint i;
+
+	if (!addr)
+		return -ENOENT;
+
+	/* the handlers, the logging and the ring */
+	if (within_module(addr, THIS_MODULE))
+		return -EPERM;
+
+	for (i = 0; i < ARRAY_SIZE(control_denied); i++)
+		if (!strcmp(funcname, control_denied[i]))
+			return -EPERM;
+
+	for (i = 0; i < ARRAY_SIZE(control_denied_prefixes); i++)
+		if (!strncmp(funcname, control_denied_prefixes[i],
+			     strlen(control_denied_prefixes[i])))
+			return -EPERM;
+
+	return 0;
+}
+
+static struct control_hook *control_find(const char *const funcname)
+{
+	uint i;
+
+	for (i = 0; i < CONTROL_HOOKS_MAX; i++)
+		if (!strcmp(control_hooks[i].funcname, funcname))
+			return &control_hooks[i];
+
+	return NULL;
+}
+
+static bool control_disarmed(const char *const funcname)
+{
+	const char *s = disarmed;
+	size_t len = strlen(funcname);
+
+	while (s && *s) {
+		if (!strncmp(s, funcname, len) && (s[len] == ',' || !s[len]))
+			return true;
+		s = strchr(s, ',');
+		if (s)
+			s++;
+	}
+
+	return false;
+}
+
+static int __must_check control_arm(struct control_hook *ch)
+{
+	struct hook *hook;
+
+	if (ch->hook)
+		return 0;
+
+	/* kprobes keep the name, it lives as long as the slot */
+	hook = hook_on_exec(ch->funcname, ch->handler, ch, ch->latency,
+			    ch->no_hbp);
+	if (IS_ERR(hook))
+		return PTR_ERR(hook);
+
+	ch->hook = hook;
+	return 0;
+}
+
+static void control_disarm(struct control_hook *ch)
+{
+	if (!ch->hook)
+		return;
+
+	hook_clear(ch->hook);
+	ch->hook = NULL;
+}
+
+/* called with control_lock held */
+static int __must_check control_register(const char *const funcname,
+					 const hook_handler_t handler,
+					 const enum latency_hook latency,
+					 const bool watch, const bool required,
+					 const bool no_hbp, const bool armed)
+{
+	struct control_hook *ch;
+	int ret;
+
+	if (!*funcname || strlen(funcname) >= KSYM_NAME_LEN)
+		return -EINVAL;
+
+	if (control_find(funcname))
+		return -EEXIST;
+
+	ch = control_find("");
+	if (!ch)
+		return -ENOSPC;
+
+	strcpy(ch->funcname, funcname);
+	ch->handler = handler;
+	ch->latency = latency;
+	ch->watch = watch;
+	ch->required = required;
+	ch->no_hbp = no_hbp;
+	ch->hook = NULL;
+
+	ret = armed ? control_arm(ch) : 0;
+	if (ret)
+		ch->funcname[0] = '\0';
+
+	return ret;
+}
+
+/* called with control_lock held */
+static void control_unregister(struct control_hook *ch)
+{
+	control_disarm(ch);
+	ch->funcname[0] = '\0';
+}
+
+/**
+ * Register the hook on funcname, armed unless it is listed in the
+ * disarmed parameter.
+ *
+ * @param required the hook can't be disarmed (the parameter included)
+ * @param no_hbp see hook_on_exec
+ */
+int __must_check control_add(const char *const funcname,
+			     const hook_handler_t handler,
+			     const enum latency_hook latency,
+			     const bool required, const bool no_hbp)
+{
+	int ret;
+
+	mutex_lock(&control_lock);
+	ret = control_register(funcname, handler, latency, false, required,
+			       no_hbp, required || !control_disarmed(funcname));
+	mutex_unlock(&control_lock);
+
+	return ret;
+}
+
+/* the hook is cleared on return */
+void control_remove(const char *const funcname)
+{
+	struct control_hook *ch;
+
+	mutex_lock(&control_lock);
+	ch = control_find(funcname);
+	if (ch)
+		control_unregister(ch);
+	mutex_unlock(&control_lock);
+}
+
+/* called with control_lock held */
+static int __must_check control_command(char *line)
+{
+	struct control_hook *ch;
+	char *cmd, *funcname;
+	int ret;
+
+	cmd = strsep(&line, " \t");
+	funcname = line ? strim(line) : NULL;
+	if (!funcname || !*funcname)
+		return -EINVAL;
+
+	if (!strcmp(cmd, "watch")) {
+		ret = control_watchable(funcname);
+		if (ret)
+			return ret;
+		/* not a debug register, the builtin hooks hold them */
+		return control_register(funcname, control_watch_handler,
+					LATENCY_WATCH, true, false, true, true);
+	}
+
+	ch = control_find(funcname);
+	if (!ch)
+		return -ENOENT;
+
+	if (!strcmp(cmd, "on"))
+		return control_arm(ch);
+
+	if (!strcmp(cmd, "off")) {
+		if (ch->required)
+			return -EPERM;
+		control_disarm(ch);
+		return 0;
+	}
+
+	if (!strcmp(cmd, "unwatch")) {
+		if (!ch->watch)
+			return -EPERM;
+		control_unregister(ch);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int control_show(struct seq_file *s, void *v)
+{
+	const struct control_hook *ch;
+	uint i;
+
+	seq_printf(s, "hook\tstate\tkind\n");
+
+	mutex_lock(&control_lock);
+	for (i = 0; i < CONTROL_HOOKS_MAX; i++) {
+		ch = &control_hooks[i];
+		if (!ch->funcname[0])
+			continue;
+		seq_printf(s, "%s\t%s\t%s\n", ch->funcname,
+			   ch->hook ? "on" : "off",
+			   ch->watch ? "watch"
+			   : ch->required ? "required" : "builtin");
+	}
+	mutex_unlock(&control_lock);
+
+	return 0;
+}
+
+/* commands are applied in order up to the first failed one */
+static ssize_t control_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	char *text, *line, *cur;
+	int ret = 0;
+
+	if (count > CONTROL_TEXT_MAX)
+		return -E2BIG;
+
+	text = kmalloc(count + 1, GFP_KERNEL);
+	if (!text)
+		return -ENOMEM;
+
+	if (copy_from_user(text, buf, count)) {
+		kfree(text);
+		return -EFAULT;
+	}
+	text[count] = '\0';
+
+	cur = text;
+	mutex_lock(&control_lock);
+	while (!ret && (line = strsep(&cur, "\n"))) {
+		line = strim(line);
+		if (*line)
+			ret = control_command(line);
+	}
+	mutex_unlock(&control_lock);
+
+	kfree(text);
+	return ret ? ret : count;
+}
+
+static int control_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, control_show, NULL);
+}
+
+static const struct file_operations control_fops = {
+	.owner = THIS_MODULE,
+	.open = control_open,
+	.read = seq_read,
+	.write = control_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int __must_check control_init(void)
+{
+	if (!proc_create(PROCNAME "_hooks", 0600, NULL, &control_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* clears the watches, builtin hooks are removed by their owners */
+void control_cleanup(void)
+{
+	uint i;
+
+	remove_proc_entry(PROCNAME "_hooks", NULL);
+
+	mutex_lock(&control_lock);
+	for (i = 0; i < CONTROL_HOOKS_MAX; i++)
+		if (control_hooks[i].funcname[0])
+			control_unregister(&control_hooks[i]);
+	mutex_unlock(&control_lock);
+}
@@ -0,0 +1,237 @@
+/**
+ * @file crossview.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief cross-view detection of hidden tasks in the kernel
+ *
+ * The scheduler hook adds every woken up thread group to a set, as the
+ * referenced group leader. A worker periodically compares the set with
+ * the pid lookup and the task list: a running task missing from either
+ * of them is logged as LOG_HIDDEN record. A discrepancy is reported
+ * once it is seen by two checks in a row, so tasks forked or exiting
+ * during a check are not taken for hidden ones. Groups that don't fit
+ * the set are not checked, they are counted in /proc/rootkiticide_stats.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#endif
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/rcupdate.h>
+#include <linux/hash.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/log2.h>
+
+#include "rootkiticide.h"
+
+static uint crossview_interval = 5000;
+module_param(crossview_interval, uint, 0444);
+MODULE_PARM_DESC(crossview_interval,
+		 "compare woken up tasks with the pid lookup and the task list "
+		 "every this many milliseconds (0 - disabled)");
+
+static uint crossview_slots = 4096;
+module_param(crossview_slots, uint, 0444);
+MODULE_PARM_DESC(crossview_slots,
+		 "thread groups the cross-view set holds (rounded up to a "
+		 "power of 2), raise it on hosts with many long-lived tasks");
+
+#define CROSSVIEW_PROBES 16	/* slots looked up before giving up */
+
+/* slot is taken, but the reference is not yet */
+#define CROSSVIEW_CLAIMED ((struct task_struct *)1)
+
+struct crossview_slot {
+	struct task_struct *task;	/* group leader, NULL - empty */
+	uint listed;			/* last check found it in the list */
+	u8 suspect;			/* HIDDEN_* seen by the last check */
+	u8 reported;			/* HIDDEN_* already logged */
+};
+
+static struct crossview_slot *crossview_table;
+static uint crossview_nr_slots;	/* a power of 2 */
+static uint crossview_check_nr;
+static atomic_t crossview_dropped = ATOMIC_INIT(0);
+
+static void crossview_check(struct work_struct *work);
+static DECLARE_DELAYED_WORK(crossview_work, crossview_check);
+
+static struct crossview_slot *crossview_slot(const struct task_struct *leader,
+					     const int i)
+{
+	return &crossview_table[(hash_ptr(leader, ilog2(crossview_nr_slots)) + i)
+				& (crossview_nr_slots - 1)];
+}
+
+/* called from the scheduler hook for the task being woken up */
+void crossview_seen(struct task_struct *task)
+{
+	struct task_struct *leader, *t;
+	struct crossview_slot *slot;
+	int i;
+
+	if (!crossview_table)
+		return;
+
+	leader = READ_ONCE(task->group_leader);
+	if (READ_ONCE(leader->exit_state))
+		return;
+
+	for (i = 0; i < CROSSVIEW_PROBES; i++) {
+		slot = crossview_slot(leader, i);
+		t = READ_ONCE(slot->task);
+		if (t == leader)
+			return;
+		if (t || cmpxchg(&slot->task, NULL, CROSSVIEW_CLAIMED))
+			continue;
+
+		/* the leader is alive while a thread of it is woken up */
+		get_task_struct(leader);
+		slot->listed = crossview_check_nr;
+		slot->suspect = 0;
+		slot->reported = 0;
+		smp_wmb();
+		WRITE_ONCE(slot->task, leader);
+		return;
+	}
+
+	atomic_inc(&crossview_dropped);
+}
+
+static struct crossview_slot *crossview_find(const struct task_struct *leader)
+{
+	struct crossview_slot *slot;
+	int i;
+
+	for (i = 0; i < CROSSVIEW_PROBES; i++) {
+		slot = crossview_slot(leader, i);
+		if (READ_ONCE(slot->task) == leader)
+			return slot;
+	}
+
+	return NULL;
+}
+
+static u8 crossview_missing(struct crossview_slot *slot, struct task_struct *t)
+{
+	u8 missing = 0;
+
+	if (slot->listed != crossview_check_nr)
+		missing |= HIDDEN_TASK_LIST;
+
+	if (pid_task(find_pid_ns(t->pid, &init_pid_ns), PIDTYPE_PID) != t)
+		missing |= HIDDEN_PID_LOOKUP;
+
+	/* unhashed on exit */
+	if (READ_ONCE(t->exit_state))
+		return 0;
+
+	return missing;
+}
+
+static void crossview_check(struct work_struct *work)
+{
+	struct crossview_slot *slot;
+	struct task_struct *p, *t;
+	u8 missing;
+	int i;
+
+	crossview_check_nr++;
+
+	rcu_read_lock();
+	for_each_process(p) {
+		slot = crossview_find(p);
+		if (slot)
+			slot->listed = crossview_check_nr;
+	}
+
+	for (i = 0; i < crossview_nr_slots; i++) {
+		slot = &crossview_table[i];
+		t = READ_ONCE(slot->task);
+		if (!t || t == CROSSVIEW_CLAIMED || READ_ONCE(t->exit_state))
+			continue;
+		smp_rmb();
+
+		missing = crossview_missing(slot, t);
+		if (missing & slot->suspect & ~slot->reported) {
+			WARN_ON(log_hidden(t, missing & slot->suspect));
+			slot->reported |= missing & slot->suspect;
+		}
+		slot->suspect = missing;
+	}
+	rcu_read_unlock();
+
+	/* exited groups leave the set, the hook adds them back if woken */
+	for (i = 0; i < crossview_nr_slots; i++) {
+		slot = &crossview_table[i];
+		t = READ_ONCE(slot->task);
+		if (!t || t == CROSSVIEW_CLAIMED || !READ_ONCE(t->exit_state))
+			continue;
+
+		WRITE_ONCE(slot->task, NULL);
+		put_task_struct(t);
+	}
+
+	schedule_delayed_work(&crossview_work,
+			      msecs_to_jiffies(crossview_interval));
+}
+
+int __must_check crossview_init(void)
+{
+	if (!crossview_interval)
+		return 0;
+
+	crossview_nr_slots = roundup_pow_of_two(max(crossview_slots,
+						    (uint)CROSSVIEW_PROBES));
+	crossview_table = vzalloc((ulong)crossview_nr_slots
+				  * sizeof(*crossview_table));
+	if (!crossview_table)
+		return -ENOMEM;
+
+	schedule_delayed_work(&crossview_work,
+			      msecs_to_jiffies(crossview_interval));
+	return 0;
+}
+
+/* size of the set and thread groups that did not fit it since load */
+void crossview_stats(struct seq_file *s)
+{
+	if (!crossview_table)
+		return;
+
+	seq_printf(s, "crossview\t%u\t%d\n", crossview_nr_slots,
+		   atomic_read(&crossview_dropped));
+}
+
+/* the scheduler hook must be cleared already */
+void crossview_cleanup(void)
+{
+	struct task_struct *t;
+	int i;
+
+	if (!crossview_table)
+		return;
+
+	cancel_delayed_work_sync(&crossview_work);
+
+	for (i = 0; i < crossview_nr_slots; i++) {
+		t = crossview_table[i].task;
+		if (t && t != CROSSVIEW_CLAIMED)
+			put_task_struct(t);
+	}
+
+	if (atomic_read(&crossview_dropped))
+		pr_info("rkcd: %d thread groups did not fit the cross-view set\n",
+			atomic_read(&crossview_dropped));
+
+	vfree(crossview_table);
+	crossview_table = NULL;
+}
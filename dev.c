@@ -0,0 +1,158 @@
+/**
+ * @file dev.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief character device for reading the ring buffers in place
+ *
+ * Blocks of the ring buffers are mapped read-only into the reader,
+ * so records are consumed without formatting or copying. See dev.h.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+
+#include "rootkiticide.h"
+#include "ringbuf.h"
+#include "dev.h"
+
+static struct rkcd_ctl *ctl;
+static size_t ctl_size;
+
+static DEFINE_MUTEX(dev_lock);
+
+static void ctl_update(const int cpu, const long offset)
+{
+	struct ringbuf *rb = per_cpu_ptr(rbuf.rbs, cpu);
+	struct rkcd_ctl_cpu *c = &ctl->cpu[cpu];
+
+	WRITE_ONCE(c->head, atomic_read(&rb->head));
+	WRITE_ONCE(c->tail, atomic_read(&rb->tail));
+	WRITE_ONCE(c->overwritten, atomic_read(&rb->overwritten));
+	if (offset >= 0) {
+		WRITE_ONCE(c->read_block, ringbuf_readblock(rb));
+		WRITE_ONCE(c->read_offset, offset);
+		smp_wmb();
+		WRITE_ONCE(c->seq, c->seq + 1);
+	}
+}
+
+static long dev_ioctl(struct file *file, uint cmd, ulong arg)
+{
+	long offset;
+
+	if (cmd != RKCD_IOC_NEXT)
+		return -ENOTTY;
+
+	if (arg >= nr_cpu_ids || !cpu_possible(arg))
+		return -EINVAL;
+
+	mutex_lock(&dev_lock);
+	log_poll_rearm();
+	offset = ringbuf_next_readblock(per_cpu_ptr(rbuf.rbs, arg));
+	ctl_update(arg, offset);
+	mutex_unlock(&dev_lock);
+
+	return offset < 0 ? offset : 0;
+}
+
+static ulong dev_mmap_size(void)
+{
+	return ctl_size +
+		nr_cpu_ids * ringbuf_num_blocks() * ringbuf_block_size();
+}
+
+static int dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	ulong cpu_size = ringbuf_num_blocks() * ringbuf_block_size();
+	ulong size = vma->vm_end - vma->vm_start;
+	int cpu, ret;
+
+	/* either (a part of) the control area to learn geometry or everything */
+	if (vma->vm_pgoff || (size > ctl_size && size != dev_mmap_size()))
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      virt_to_phys(ctl) >> PAGE_SHIFT, min(size, ctl_size),
+			      vma->vm_page_prot);
+	if (ret || size <= ctl_size)
+		return ret;
+
+	/* ranges of impossible cpus stay unmapped */
+	for_each_possible_cpu(cpu) {
+		ret = ringbuf_mmap(per_cpu_ptr(rbuf.rbs, cpu), vma,
+				   vma->vm_start + ctl_size + cpu * cpu_size);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int dev_open(struct inode *inode, struct file *file)
+{
+	/* records are consumed by blocks, so no one else may read */
+	return reader_acquire(file, true);
+}
+
+static int dev_release(struct inode *inode, struct file *file)
+{
+	reader_release(file, true);
+	return 0;
+}
+
+static const struct file_operations dev_fops = {
+	.owner = THIS_MODULE,
+	.open = dev_open,
+	.release = dev_release,
+	.mmap = dev_mmap,
+	.poll = log_poll,
+	.unlocked_ioctl = dev_ioctl,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice dev_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = PROCNAME,
+	.fops = &dev_fops,
+	.mode = 0400,
+};
+
+int __must_check dev_init(void)
+{
+	int cpu, ret;
+
+	ctl_size = PAGE_ALIGN(sizeof(*ctl) + nr_cpu_ids * sizeof(ctl->cpu[0]));
+	ctl = alloc_pages_exact(ctl_size, GFP_KERNEL | __GFP_ZERO);
+	if (!ctl)
+		return -ENOMEM;
+
+	ctl->magic = RKCD_CTL_MAGIC;
+	ctl->version = RKCD_CTL_VERSION;
+	ctl->nr_cpus = nr_cpu_ids;
+	ctl->num_blocks = ringbuf_num_blocks();
+	ctl->block_size = ringbuf_block_size();
+	ctl->ctl_size = ctl_size;
+	for_each_possible_cpu(cpu)
+		ctl_update(cpu, -EAGAIN);
+
+	ret = misc_register(&dev_misc);
+	if (ret)
+		free_pages_exact(ctl, ctl_size);
+
+	return ret;
+}
+
+void dev_cleanup(void)
+{
+	misc_deregister(&dev_misc);
+	free_pages_exact(ctl, ctl_size);
+}
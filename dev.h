@@ -0,0 +1,46 @@
+/**
+ * @file dev.h
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief layout of the mmap'able character device, mirrored in rkcdcli
+ *
+ * Mapping starts with the control area (struct rkcd_ctl), followed by
+ * the blocks of every cpu ring: block i of cpu c is placed at
+ * ctl_size + (c * num_blocks + i) * block_size.
+ *
+ * RKCD_IOC_NEXT(cpu) drops the current read block of the cpu and swaps
+ * in the next full one, its entries start at read_offset of read_block.
+ *
+ * Entries hold the records of log_entry.h, so a new LOG_STREAM_VERSION
+ * bumps RKCD_CTL_VERSION as well.
+ */
+
+#pragma once
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define RKCD_CTL_MAGIC 0x64636b72	/* "rkcd" */
+#define RKCD_CTL_VERSION 4
+
+#define RKCD_IOC_NEXT _IO('r', 1)
+
+struct rkcd_ctl_cpu {
+	u32 head;		/* ring offsets, see struct ringbuf */
+	u32 tail;
+	u32 overwritten;
+	u32 read_block;		/* block index within the cpu ring */
+	u32 read_offset;	/* first entry in read_block */
+	u32 seq;		/* read blocks handed out */
+};
+
+struct rkcd_ctl {
+	u32 magic;
+	u16 version;
+	u16 nr_cpus;
+	u32 num_blocks;		/* per cpu, the read block included */
+	u32 block_size;
+	u32 ctl_size;		/* offset of the first block */
+	u32 reserved;
+	struct rkcd_ctl_cpu cpu[];
+};
@@ -9,23 +9,34 @@
 #include <linux/kernel.h>
 #include <linux/version.h>
 #include <linux/fs.h>
-#include <linux/perf_event.h>
 #include <linux/namei.h>
 #include <linux/fdtable.h>
+#include <linux/fs_struct.h>
 #include <linux/net.h>
 #include <linux/delay.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/dcache.h>
+#include <linux/seqlock.h>
+#include <linux/kallsyms.h>
 #include <asm/pgtable.h>
 
 #include "rootkiticide.h"
 
-static struct perf_event * __percpu *vfs_write_hbp;
-static struct perf_event * __percpu *vfs_writev_hbp;
+static uint fd_snapshot_interval = 0;
+module_param(fd_snapshot_interval, uint, 0644);
+MODULE_PARM_DESC(fd_snapshot_interval,
+		 "dump the whole fd table of a writing task at most once per "
+		 "this many milliseconds (0 - only the written file is logged)");
 
 static int __must_check dump_socket(struct socket *sock)
 {
 	ulong ret;
 	struct sockaddr_storage saddr;
 	int buflen;
+	u32 cookie;
 	ret = sock->ops->getname(sock, (struct sockaddr *)&saddr, &buflen, 1);
 	if (IS_ERR_VALUE(ret))
 		return ret;
@@ -34,17 +45,116 @@ static int __must_check dump_socket(struct socket *sock)
 	if (family != AF_INET && family != AF_INET6)
 		return -EINVAL;
 
-	return log_socket(&saddr);
+	/* the same socket reconnected to another peer is a new record */
+	if (log_seen(LOG_SOCKET, sock->sk, jhash(&saddr, buflen, 0), &cookie))
+		return 0;
+
+	return log_socket(&saddr, cookie);
+}
+
+#define PATH_CACHE_SLOTS 64	/* Must be a power of 2 */
+#define PATH_CACHE_NAME_MAX 256	/* longer paths are not cached */
+
+/*
+ * Path of a dentry on a mount, valid while no rename and no change of
+ * the mount tree (mount --move, lazy umount of a parent) happened.
+ * Parent and name hash tell apart a freed and reused dentry. d_path is
+ * relative to the root of the task, so a chrooted task gets its own.
+ */
+struct path_cache_slot {
+	const struct dentry *dentry;
+	const struct vfsmount *mnt;
+	struct path root;
+	const struct dentry *parent;
+	u32 name_hash;
+	uint rename_seq;	/* of rename_lock */
+	uint mount_seq;		/* of mount_lock */
+	char path[PATH_CACHE_NAME_MAX];
+};
+
+/* handlers can't be nested on a cpu, so a buffer per cpu is enough */
+struct path_scratch {
+	char buf[PATH_MAX];
+	struct path_cache_slot cache[PATH_CACHE_SLOTS];
+};
+
+static struct path_scratch __percpu *path_scratch;
+
+/* fs/mount.h is internal, NULL - paths are not cached */
+static seqlock_t *path_mount_lock;
+
+/**
+ * Path of the file, cached per cpu by its dentry, mount and the root of
+ * current task instead of d_path on every hit. Any rename or change of
+ * the mounts drops the cache, unlinked files are not cached (d_path
+ * marks them as deleted).
+ *
+ * @return path valid until the handler returns or ERR_PTR
+ */
+static const char *file_path(const struct path *const path)
+{
+	struct path_scratch *scratch = this_cpu_ptr(path_scratch);
+	struct dentry *dentry = path->dentry;
+	struct path_cache_slot *slot;
+	struct fs_struct *fs = current->fs;
+	struct path root = {};
+	uint seq = raw_read_seqcount(&rename_lock.seqcount);
+	uint mount_seq = path_mount_lock ?
+		raw_read_seqcount(&path_mount_lock->seqcount) : 1;
+	bool cacheable = !(seq & 1) && !(mount_seq & 1) && !d_unlinked(dentry)
+		&& fs;
+	char *name;
+	size_t len;
+
+	if (fs) {
+		root.mnt = READ_ONCE(fs->root.mnt);
+		root.dentry = READ_ONCE(fs->root.dentry);
+	}
+
+	slot = &scratch->cache[hash_ptr(dentry, ilog2(PATH_CACHE_SLOTS))];
+	if (cacheable && slot->dentry == dentry && slot->mnt == path->mnt
+	    && slot->root.mnt == root.mnt && slot->root.dentry == root.dentry
+	    && slot->parent == dentry->d_parent
+	    && slot->name_hash == dentry->d_name.hash
+	    && slot->rename_seq == seq && slot->mount_seq == mount_seq)
+		return slot->path;
+
+	name = d_path(path, scratch->buf, sizeof(scratch->buf));
+	if (IS_ERR(name))
+		return name;
+
+	/* d_path puts the path at the end of the buffer */
+	len = scratch->buf + sizeof(scratch->buf) - 1 - name;
+	/* a chroot, rename or mount racing with d_path is not cached */
+	cacheable = cacheable && READ_ONCE(fs->root.mnt) == root.mnt
+		&& READ_ONCE(fs->root.dentry) == root.dentry
+		&& !read_seqcount_retry(&rename_lock.seqcount, seq)
+		&& !read_seqcount_retry(&path_mount_lock->seqcount, mount_seq);
+	if (cacheable && len < PATH_CACHE_NAME_MAX) {
+		slot->dentry = dentry;
+		slot->mnt = path->mnt;
+		slot->root = root;
+		slot->parent = dentry->d_parent;
+		slot->name_hash = dentry->d_name.hash;
+		slot->rename_seq = seq;
+		slot->mount_seq = mount_seq;
+		memcpy(slot->path, name, len + 1);
+	}
+
+	return name;
 }
 
 static int __must_check dump_file(struct file *file)
 {
-	char buf[PATH_MAX] = { 0 };
-	char *filename = d_path(&file->f_path, buf, sizeof(buf));
+	u32 cookie;
+	if (log_seen(LOG_FILE, file, (ulong)file->f_path.dentry, &cookie))
+		return 0;
+
+	const char *filename = file_path(&file->f_path);
 	if (IS_ERR_OR_NULL(filename))
 		return PTR_ERR(filename);
 
-	return log_file(filename);
+	return log_file(filename, cookie);
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,5,0)
@@ -60,7 +170,7 @@ static struct socket *sock_from_file(struct file *file, int *err)
 }
 #endif
 
-static int __must_check dump_all_fds(const void *v, struct file *file, uint fd)
+static int dump_fd(struct file *file)
 {
 	int err;
 
@@ -77,6 +187,36 @@ static int __must_check dump_all_fds(const void *v, struct file *file, uint fd)
 	return 0;
 }
 
+static int __must_check dump_all_fds(const void *v, struct file *file, uint fd)
+{
+	return dump_fd(file);
+}
+
+#define FD_SNAPSHOT_SLOTS 1024	/* Must be a power of 2 */
+
+/*
+ * Time of the last fd table snapshot per task, slot is selected by tgid
+ * and holds (tgid << 32 | jiffies). Collisions only cause an extra or
+ * a postponed snapshot.
+ */
+static atomic64_t fd_snapshot_stamps[FD_SNAPSHOT_SLOTS];
+
+static bool __must_check fd_snapshot_due(void)
+{
+	u32 now = jiffies;
+	u32 interval = msecs_to_jiffies(fd_snapshot_interval);
+	atomic64_t *slot = &fd_snapshot_stamps[hash_32(current->tgid,
+						ilog2(FD_SNAPSHOT_SLOTS))];
+	u64 stamp = atomic64_read(slot);
+
+	if ((stamp >> 32) == (u32)current->tgid && now - (u32)stamp < interval)
+		return false;
+
+	/* only one of concurrent writers of the task takes the snapshot */
+	return atomic64_cmpxchg(slot, stamp, (u64)current->tgid << 32 | now)
+		== stamp;
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0)
 /* helper introduced in c3c073f808b22dfae15ef8412b6f7b998644139a */
 int iterate_fd(struct files_struct *files, unsigned n,
@@ -103,12 +243,23 @@ int iterate_fd(struct files_struct *files, unsigned n,
 #endif
 
 static atomic_t x_fd_handler_usage = ATOMIC_INIT(0);
-static void x_fd_handler(struct perf_event *bp,
-			 struct perf_sample_data *data,
-			 struct pt_regs *regs)
+static void x_fd_handler(struct pt_regs *regs, void *data)
 {
 	atomic_inc(&x_fd_handler_usage);
-	iterate_fd(current->files, 0, dump_all_fds, NULL);
+	/* files and sockets are only checked against the path/net rules */
+	if (filter_task() || reader_excluded() || !governor_admit()) {
+		atomic_dec(&x_fd_handler_usage);
+		return;
+	}
+
+	/* both __vfs_write and vfs_writev take the file as first argument */
+	dump_fd((struct file *)hook_first_arg(regs));
+
+	if (fd_snapshot_interval && fd_snapshot_due()) {
+		log_batch_begin();
+		iterate_fd(current->files, 0, dump_all_fds, NULL);
+		log_batch_end();
+	}
 	atomic_dec(&x_fd_handler_usage);
 }
 
@@ -120,14 +271,34 @@ int __must_check fd_hook_init(void)
 	if (!socket_op || !is_kernel_address_valid((ulong)socket_op))
 		return -EINVAL;
 #endif
-	/* Set hardware breakpoint on vfs functions */
-	vfs_write_hbp = hbp_on_exec("__vfs_write", x_fd_handler);
-	if (IS_ERR(vfs_write_hbp))
-		return PTR_ERR(vfs_write_hbp);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+	/* a seqlock since 3.13, vfsmount_lock was a brlock before */
+	path_mount_lock = (seqlock_t *)kallsyms_lookup_name("mount_lock");
+	if (path_mount_lock && !is_kernel_address_valid((ulong)path_mount_lock))
+		path_mount_lock = NULL;
+#endif
+	if (!path_mount_lock)
+		pr_info("rkcd: no mount_lock, paths of files are not cached\n");
+
+	path_scratch = alloc_percpu(struct path_scratch);
+	if (!path_scratch)
+		return -ENOMEM;
 
-	vfs_writev_hbp = hbp_on_exec("vfs_writev", x_fd_handler);
-	if (IS_ERR(vfs_writev_hbp))
-		return PTR_ERR(vfs_writev_hbp);
+	/* Set hooks on vfs functions */
+	int ret = control_add("__vfs_write", x_fd_handler, LATENCY_VFS_WRITE,
+			      false, false);
+	if (ret) {
+		free_percpu(path_scratch);
+		return ret;
+	}
+
+	ret = control_add("vfs_writev", x_fd_handler, LATENCY_VFS_WRITEV,
+			  false, false);
+	if (ret) {
+		control_remove("__vfs_write");
+		free_percpu(path_scratch);
+		return ret;
+	}
 
 	return 0;
 }
@@ -137,6 +308,7 @@ void fd_hook_cleanup(void)
 	while (atomic_read(&x_fd_handler_usage))
 		msleep_interruptible(100);
 
-	hbp_clear(vfs_write_hbp);
-	hbp_clear(vfs_writev_hbp);
+	control_remove("__vfs_write");
+	control_remove("vfs_writev");
+	free_percpu(path_scratch);
 }
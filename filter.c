@@ -0,0 +1,438 @@
+/**
+ * @file filter.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief filter rules for known noisy tasks, paths and addresses
+ *
+ * Rules are written to /proc/rootkiticide_filter as text, one per line:
+ *
+ *	comm <name>			tasks with this comm
+ *	tgid <tgid>
+ *	uid <uid>
+ *	path <prefix>			files starting with the prefix
+ *	net <addr>[/<bits>] [<port>[-<port>]]	sockets connected to it
+ *
+ * Every write replaces the whole rule set, an empty one drops it.
+ * Rules are compiled into a table swapped under RCU, so handlers look
+ * it up without locks and events it matches never reach the ring.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/sched.h>
+#include <linux/cred.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/sort.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/inet.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#include "rootkiticide.h"
+
+#define FILTER_RULES_MAX 64	/* of each kind */
+#define FILTER_POOL_SIZE 4096	/* for path prefixes */
+#define FILTER_TEXT_MAX (4 * PAGE_SIZE)
+
+struct filter_path {
+	u16 off;		/* in the pool */
+	u16 len;
+};
+
+struct filter_net {
+	sa_family_t family;
+	u8 bits;		/* of addr compared */
+	u16 port_lo;		/* host order, 0-65535 - any port */
+	u16 port_hi;
+	u8 addr[16];
+};
+
+struct filter_table {
+	struct rcu_head rcu;
+	uint nr_comms, nr_tgids, nr_uids, nr_paths, nr_nets;
+	char comms[FILTER_RULES_MAX][TASK_COMM_LEN];
+	pid_t tgids[FILTER_RULES_MAX];		/* sorted */
+	uid_t uids[FILTER_RULES_MAX];		/* sorted */
+	struct filter_path paths[FILTER_RULES_MAX];
+	struct filter_net nets[FILTER_RULES_MAX];
+	uint pool_used;
+	char pool[FILTER_POOL_SIZE];
+};
+
+static struct filter_table __rcu *filter_table;
+static DEFINE_MUTEX(filter_lock);
+
+static bool filter_sorted_has(const u32 *array, const uint nr, const u32 key)
+{
+	uint lo = 0, hi = nr, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (array[mid] == key)
+			return true;
+		if (array[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return false;
+}
+
+static bool filter_task_match(const struct filter_table *table)
+{
+	uint i;
+
+	for (i = 0; i < table->nr_comms; i++)
+		if (!strncmp(current->comm, table->comms[i], TASK_COMM_LEN))
+			return true;
+
+	if (filter_sorted_has((const u32 *)table->tgids, table->nr_tgids,
+			      current->tgid))
+		return true;
+
+	if (!table->nr_uids)
+		return false;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,5,0)
+	return filter_sorted_has(table->uids, table->nr_uids, current_uid());
+#else
+	return filter_sorted_has(table->uids, table->nr_uids,
+				 from_kuid_munged(&init_user_ns, current_uid()));
+#endif
+}
+
+/**
+ * Check current task against the rules, called by handlers first
+ * so rejected events cost no more than the lookup.
+ *
+ * @return true if events of the task must not be logged.
+ */
+bool __must_check filter_task(void)
+{
+	const struct filter_table *table;
+	bool drop = false;
+
+	rcu_read_lock();
+	table = rcu_dereference(filter_table);
+	if (table)
+		drop = filter_task_match(table);
+	rcu_read_unlock();
+
+	return drop;
+}
+
+bool __must_check filter_file(const char *const filename, const size_t len)
+{
+	const struct filter_table *table;
+	const struct filter_path *path;
+	bool drop = false;
+	uint i;
+
+	rcu_read_lock();
+	table = rcu_dereference(filter_table);
+	for (i = 0; table && i < table->nr_paths && !drop; i++) {
+		path = &table->paths[i];
+		drop = len >= path->len
+			&& !memcmp(filename, table->pool + path->off, path->len);
+	}
+	rcu_read_unlock();
+
+	return drop;
+}
+
+/* the first bits of a and b are equal */
+static bool filter_prefix_match(const u8 *a, const u8 *b, const uint bits)
+{
+	uint bytes = bits / 8;
+	u8 mask = 0xff << (8 - bits % 8);
+
+	if (memcmp(a, b, bytes))
+		return false;
+
+	return !(bits % 8) || !((a[bytes] ^ b[bytes]) & mask);
+}
+
+bool __must_check filter_socket(const struct sockaddr_storage *const saddr)
+{
+	const struct sockaddr_in *in = (const struct sockaddr_in *)saddr;
+	const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)saddr;
+	const struct filter_table *table;
+	const struct filter_net *net;
+	const u8 *addr;
+	bool drop = false;
+	u16 port;
+	uint i;
+
+	if (saddr->ss_family == AF_INET) {
+		addr = (const u8 *)&in->sin_addr;
+		port = ntohs(in->sin_port);
+	} else {
+		addr = (const u8 *)&in6->sin6_addr;
+		port = ntohs(in6->sin6_port);
+	}
+
+	rcu_read_lock();
+	table = rcu_dereference(filter_table);
+	for (i = 0; table && i < table->nr_nets && !drop; i++) {
+		net = &table->nets[i];
+		drop = net->family == saddr->ss_family
+			&& port >= net->port_lo && port <= net->port_hi
+			&& filter_prefix_match(addr, net->addr, net->bits);
+	}
+	rcu_read_unlock();
+
+	return drop;
+}
+
+static int filter_parse_net(struct filter_net *net, char *arg, char *ports)
+{
+	char *bits = strchr(arg, '/');
+	const char *end;
+	uint max_bits;
+	int ret;
+
+	if (bits)
+		*bits++ = '\0';
+
+	if (in4_pton(arg, -1, net->addr, -1, &end)) {
+		net->family = AF_INET;
+		max_bits = 32;
+	} else if (in6_pton(arg, -1, net->addr, -1, &end)) {
+		net->family = AF_INET6;
+		max_bits = 128;
+	} else {
+		return -EINVAL;
+	}
+
+	net->bits = max_bits;
+	if (bits) {
+		ret = kstrtou8(bits, 10, &net->bits);
+		if (ret)
+			return ret;
+		if (net->bits > max_bits)
+			return -EINVAL;
+	}
+
+	net->port_lo = 0;
+	net->port_hi = U16_MAX;
+	if (!ports)
+		return 0;
+
+	arg = strsep(&ports, "-");
+	ret = kstrtou16(arg, 10, &net->port_lo);
+	if (ret)
+		return ret;
+
+	net->port_hi = net->port_lo;
+	if (ports) {
+		ret = kstrtou16(ports, 10, &net->port_hi);
+		if (ret)
+			return ret;
+	}
+
+	return net->port_lo <= net->port_hi ? 0 : -EINVAL;
+}
+
+static int filter_parse_rule(struct filter_table *table, char *line)
+{
+	char *kind, *arg, *extra;
+	size_t len;
+
+	kind = strsep(&line, " \t");
+	line = skip_spaces(line ? line : "");
+	arg = strsep(&line, " \t");
+	extra = line ? strim(line) : NULL;
+	if (!arg || !*arg)
+		return -EINVAL;
+
+	if (!strcmp(kind, "comm")) {
+		if (extra || table->nr_comms == FILTER_RULES_MAX
+		    || strlen(arg) >= TASK_COMM_LEN)
+			return -EINVAL;
+		strncpy(table->comms[table->nr_comms++], arg, TASK_COMM_LEN);
+		return 0;
+	}
+
+	if (!strcmp(kind, "tgid")) {
+		if (extra || table->nr_tgids == FILTER_RULES_MAX)
+			return -EINVAL;
+		return kstrtoint(arg, 10, &table->tgids[table->nr_tgids++]);
+	}
+
+	if (!strcmp(kind, "uid")) {
+		if (extra || table->nr_uids == FILTER_RULES_MAX)
+			return -EINVAL;
+		return kstrtouint(arg, 10, &table->uids[table->nr_uids++]);
+	}
+
+	if (!strcmp(kind, "path")) {
+		len = strlen(arg);
+		if (extra || table->nr_paths == FILTER_RULES_MAX
+		    || table->pool_used + len > FILTER_POOL_SIZE)
+			return -EINVAL;
+		table->paths[table->nr_paths].off = table->pool_used;
+		table->paths[table->nr_paths++].len = len;
+		memcpy(table->pool + table->pool_used, arg, len);
+		table->pool_used += len;
+		return 0;
+	}
+
+	if (!strcmp(kind, "net")) {
+		if (table->nr_nets == FILTER_RULES_MAX
+		    || (extra && strpbrk(extra, " \t")))
+			return -EINVAL;
+		return filter_parse_net(&table->nets[table->nr_nets++], arg,
+					extra && *extra ? extra : NULL);
+	}
+
+	return -EINVAL;
+}
+
+static int filter_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* @return NULL if there are no rules or ERR_PTR */
+static struct filter_table *filter_compile(char *text)
+{
+	struct filter_table *table = kzalloc(sizeof(*table), GFP_KERNEL);
+	char *line;
+	int nr = 0, ret;
+
+	if (!table)
+		return ERR_PTR(-ENOMEM);
+
+	while ((line = strsep(&text, "\n"))) {
+		nr++;
+		line = strim(line);
+		if (!*line || *line == '#')
+			continue;
+
+		ret = filter_parse_rule(table, line);
+		if (ret) {
+			pr_warn("rkcd: invalid filter rule at line %d\n", nr);
+			kfree(table);
+			return ERR_PTR(ret);
+		}
+	}
+
+	if (!table->nr_comms && !table->nr_tgids && !table->nr_uids
+	    && !table->nr_paths && !table->nr_nets) {
+		kfree(table);
+		return NULL;
+	}
+
+	sort(table->tgids, table->nr_tgids, sizeof(table->tgids[0]),
+	     filter_cmp_u32, NULL);
+	sort(table->uids, table->nr_uids, sizeof(table->uids[0]),
+	     filter_cmp_u32, NULL);
+	return table;
+}
+
+static int filter_show(struct seq_file *s, void *v)
+{
+	const struct filter_table *table;
+	const struct filter_net *net;
+	uint i;
+
+	mutex_lock(&filter_lock);
+	table = rcu_dereference_protected(filter_table,
+					  lockdep_is_held(&filter_lock));
+	for (i = 0; table && i < table->nr_comms; i++)
+		seq_printf(s, "comm %s\n", table->comms[i]);
+	for (i = 0; table && i < table->nr_tgids; i++)
+		seq_printf(s, "tgid %d\n", table->tgids[i]);
+	for (i = 0; table && i < table->nr_uids; i++)
+		seq_printf(s, "uid %u\n", table->uids[i]);
+	for (i = 0; table && i < table->nr_paths; i++)
+		seq_printf(s, "path %.*s\n", table->paths[i].len,
+			   table->pool + table->paths[i].off);
+	for (i = 0; table && i < table->nr_nets; i++) {
+		net = &table->nets[i];
+		if (net->family == AF_INET)
+			seq_printf(s, "net %pI4/%u", net->addr, net->bits);
+		else
+			seq_printf(s, "net %pI6c/%u", net->addr, net->bits);
+		if (net->port_lo || net->port_hi != U16_MAX)
+			seq_printf(s, " %u-%u", net->port_lo, net->port_hi);
+		seq_putc(s, '\n');
+	}
+	mutex_unlock(&filter_lock);
+
+	return 0;
+}
+
+static ssize_t filter_write(struct file *file, const char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	struct filter_table *table, *old;
+	char *text;
+
+	if (count > FILTER_TEXT_MAX)
+		return -E2BIG;
+
+	text = kmalloc(count + 1, GFP_KERNEL);
+	if (!text)
+		return -ENOMEM;
+
+	if (copy_from_user(text, buf, count)) {
+		kfree(text);
+		return -EFAULT;
+	}
+	text[count] = '\0';
+
+	table = filter_compile(text);
+	kfree(text);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+
+	mutex_lock(&filter_lock);
+	old = rcu_dereference_protected(filter_table,
+					lockdep_is_held(&filter_lock));
+	rcu_assign_pointer(filter_table, table);
+	mutex_unlock(&filter_lock);
+
+	if (old)
+		kfree_rcu(old, rcu);
+
+	return count;
+}
+
+static int filter_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, filter_show, NULL);
+}
+
+static const struct file_operations filter_fops = {
+	.owner = THIS_MODULE,
+	.open = filter_open,
+	.read = seq_read,
+	.write = filter_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int __must_check filter_init(void)
+{
+	if (!proc_create(PROCNAME "_filter", 0600, NULL, &filter_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* the hooks must be cleared already */
+void filter_cleanup(void)
+{
+	remove_proc_entry(PROCNAME "_filter", NULL);
+	kfree(rcu_dereference_protected(filter_table, true));
+}
@@ -0,0 +1,155 @@
+/**
+ * @file governor.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief overload governor of the hook handlers
+ *
+ * Every cpu accounts the cycles spent in the handlers of each hook over
+ * intervals of governor_interval milliseconds. When the handlers of a
+ * hook take more than governor_budget percent of an interval, events of
+ * the hook are sampled on the cpu: the first event of a task in the
+ * interval is logged, of the others 1 in 2^level. The level goes up
+ * after every interval over the budget and down after every interval
+ * under half of it. Handlers still do the work that must see every
+ * event (crossview, following forks of readers), only logging is cut.
+ *
+ * Every interval a hook was sampled in ends with a LOG_SAMPLING record
+ * with the level and the number of events not logged, so the analysis
+ * knows its coverage.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include <linux/hash.h>
+#include <linux/math64.h>
+#include <asm/timex.h>
+
+#include "rootkiticide.h"
+
+#define GOVERNOR_LEVEL_MAX 10	/* 1 in 1024 */
+#define GOVERNOR_TASKS 64	/* Must be a power of 2 */
+
+static uint governor_budget = 5;
+module_param(governor_budget, uint, 0644);
+MODULE_PARM_DESC(governor_budget,
+		 "sample events of a hook taking more than this percent of "
+		 "a cpu (0 - never sample)");
+
+static uint governor_interval = 100;
+module_param(governor_interval, uint, 0644);
+MODULE_PARM_DESC(governor_interval,
+		 "milliseconds the time of the hooks is accounted over");
+
+struct governor_state {
+	ulong window;		/* jiffies at the start of the interval */
+	cycles_t start;		/* cycles at the start of the interval */
+	u64 spent;		/* cycles in the handlers */
+	u32 hits;
+	u32 skipped;		/* events not logged */
+	u8 level;		/* 0 - everything is logged */
+};
+
+/* task logged in the interval, collisions only log an extra event */
+struct governor_task {
+	pid_t tgid;
+	u32 window;
+};
+
+struct governor_cpu {
+	enum latency_hook hook;	/* of the running handler */
+	struct governor_state state[LATENCY_HOOKS];
+	struct governor_task tasks[LATENCY_HOOKS][GOVERNOR_TASKS];
+};
+
+static struct governor_cpu __percpu *governor;
+
+/* called by hook_call with irqs disabled, before the handler */
+void governor_enter(const enum latency_hook hook)
+{
+	this_cpu_ptr(governor)->hook = hook;
+}
+
+/**
+ * Check whether the event of the running handler is logged.
+ *
+ * @return false if it must be skipped (it is counted as such).
+ */
+bool __must_check governor_admit(void)
+{
+	struct governor_cpu *gc = this_cpu_ptr(governor);
+	struct governor_state *state = &gc->state[gc->hook];
+	struct governor_task *task;
+
+	if (likely(!state->level))
+		return true;
+
+	task = &gc->tasks[gc->hook][hash_32(current->tgid,
+					    ilog2(GOVERNOR_TASKS))];
+	if (task->tgid != current->tgid || task->window != (u32)state->window) {
+		task->tgid = current->tgid;
+		task->window = state->window;
+		return true;
+	}
+
+	if (!(state->hits & ((1U << state->level) - 1)))
+		return true;
+
+	state->skipped++;
+	return false;
+}
+
+static void governor_adjust(const enum latency_hook hook,
+			    struct governor_state *state, const cycles_t now)
+{
+	u64 elapsed = now - state->start;
+	u32 load = elapsed ? div64_u64(state->spent * 1000, elapsed) : 0;
+	u8 level = state->level;
+
+	if (!governor_budget)
+		level = 0;
+	else if (load > governor_budget * 10 && level < GOVERNOR_LEVEL_MAX)
+		level++;
+	else if (load <= governor_budget * 5 && level)
+		level--;
+
+	if (level != state->level || state->skipped)
+		WARN_ON(log_sampling(hook, level, state->skipped, load));
+
+	state->window = jiffies;
+	state->start = now;
+	state->spent = 0;
+	state->hits = 0;
+	state->skipped = 0;
+	state->level = level;
+}
+
+/* called by hook_call with irqs disabled, after the handler */
+void governor_exit(const cycles_t start)
+{
+	struct governor_cpu *gc = this_cpu_ptr(governor);
+	struct governor_state *state = &gc->state[gc->hook];
+	cycles_t now = get_cycles();
+
+	state->spent += now - start;
+	state->hits++;
+
+	if (time_after_eq(jiffies, state->window
+			  + msecs_to_jiffies(governor_interval)))
+		governor_adjust(gc->hook, state, now);
+}
+
+int __must_check governor_init(void)
+{
+	governor = alloc_percpu(struct governor_cpu);
+	if (!governor)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void governor_cleanup(void)
+{
+	free_percpu(governor);
+}
@@ -0,0 +1,253 @@
+/**
+ * @file hook.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief hooks on function entry with a selectable backend
+ *
+ * Backends:
+ *   hbp    - hardware breakpoint (hw_breakpoint.c), at most four hooks
+ *            on x86, each hit is a #DB exception plus perf dispatch.
+ *            Hooks that would rather not take a debug register are
+ *            kprobes with this backend;
+ *   kprobe - int3 or jump optimized probe, no limit on hooks;
+ *   ftrace - callback from the fentry call site, needs
+ *            CONFIG_DYNAMIC_FTRACE_WITH_REGS, no limit on hooks.
+ *
+ * Handlers are called with interrupts disabled whatever the backend is,
+ * so they keep running as in #DB context: per-cpu data is stable. A hit
+ * on a cpu that is already running a handler, of a watch on something
+ * the handler calls, is dropped, so handlers are never nested.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/kallsyms.h>
+#include <linux/kprobes.h>
+#include <linux/ftrace.h>
+#include <linux/perf_event.h>
+#include <linux/irqflags.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+
+#include "rootkiticide.h"
+
+static char *hook_backend = "hbp";
+module_param(hook_backend, charp, 0444);
+MODULE_PARM_DESC(hook_backend,
+		 "mechanism of the hooks: hbp (hardware breakpoints), "
+		 "kprobe or ftrace");
+
+enum hook_type {
+	HOOK_HBP,
+	HOOK_KPROBE,
+	HOOK_FTRACE
+};
+
+struct hook {
+	enum hook_type type;
+	hook_handler_t handler;
+	void *data;		/* passed to the handler */
+	enum latency_hook latency;
+	union {
+		struct perf_event * __percpu *hbp;
+		struct kprobe kp;
+		struct ftrace_ops ops;
+	};
+};
+
+static DEFINE_PER_CPU(bool, hook_running);
+
+static void notrace hook_call(struct hook *hook, struct pt_regs *regs)
+{
+	ulong flags;
+	cycles_t start = get_cycles();
+
+	local_irq_save(flags);
+	if (this_cpu_read(hook_running)) {
+		local_irq_restore(flags);
+		return;
+	}
+	this_cpu_write(hook_running, true);
+
+	governor_enter(hook->latency);
+	hook->handler(regs, hook->data);
+	latency_record(hook->latency, start);
+	governor_exit(start);
+
+	this_cpu_write(hook_running, false);
+	local_irq_restore(flags);
+}
+
+static void hook_hbp_handler(struct perf_event *bp,
+			     struct perf_sample_data *data,
+			     struct pt_regs *regs)
+{
+	hook_call(bp->overflow_handler_context, regs);
+}
+
+static int hook_kprobe_handler(struct kprobe *kp, struct pt_regs *regs)
+{
+	hook_call(container_of(kp, struct hook, kp), regs);
+	return 0;
+}
+
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_REGS
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+static void notrace hook_ftrace_handler(ulong ip, ulong parent_ip,
+					struct ftrace_ops *ops,
+					struct ftrace_regs *fregs)
+{
+	struct pt_regs *regs = ftrace_get_regs(fregs);
+#else
+static void notrace hook_ftrace_handler(ulong ip, ulong parent_ip,
+					struct ftrace_ops *ops,
+					struct pt_regs *regs)
+{
+#endif
+	hook_call(container_of(ops, struct hook, ops), regs);
+}
+
+static int __must_check hook_ftrace_register(struct hook *hook,
+					     const char *const funcname)
+{
+	int ret;
+	ulong site, addr = kallsyms_lookup_name(funcname);
+	if (!addr || !is_kernel_address_valid(addr))
+		return -EINVAL;
+
+	/* not traceable, or a notrace function */
+	site = ftrace_location(addr);
+	if (!site)
+		return -EINVAL;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+	/* with IBT the fentry call is after the endbr, not at the symbol */
+	addr = site;
+#endif
+
+	hook->ops.func = hook_ftrace_handler;
+	hook->ops.flags = FTRACE_OPS_FL_SAVE_REGS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+	/* before it the recursion protection is on unless opted out */
+	hook->ops.flags |= FTRACE_OPS_FL_RECURSION;
+#endif
+
+	ret = ftrace_set_filter_ip(&hook->ops, addr, 0, 0);
+	if (ret)
+		return ret;
+
+	ret = register_ftrace_function(&hook->ops);
+	if (ret)
+		ftrace_set_filter_ip(&hook->ops, addr, 1, 0);
+
+	return ret;
+}
+
+static void hook_ftrace_unregister(struct hook *hook)
+{
+	unregister_ftrace_function(&hook->ops);
+	ftrace_free_filter(&hook->ops);
+}
+#else
+static int __must_check hook_ftrace_register(struct hook *hook,
+					     const char *const funcname)
+{
+	return -EOPNOTSUPP;
+}
+
+static void hook_ftrace_unregister(struct hook *hook)
+{
+}
+#endif
+
+/**
+ * Call handler on every entry to funcname.
+ *
+ * @param data passed to the handler as is
+ * @param latency histogram to record the time spent in the handler
+ * @param no_hbp use a kprobe instead of a debug register with the hbp
+ * backend
+ * @return hook to pass to hook_clear or ERR_PTR
+ */
+struct hook * __must_check hook_on_exec(const char *const funcname,
+					const hook_handler_t handler,
+					void *const data,
+					const enum latency_hook latency,
+					const bool no_hbp)
+{
+	int ret;
+	const char *backend = hook_backend;
+	struct hook *hook = kzalloc(sizeof(*hook), GFP_KERNEL);
+	if (!hook)
+		return ERR_PTR(-ENOMEM);
+
+	hook->handler = handler;
+	hook->data = data;
+	hook->latency = latency;
+
+	if (no_hbp && !strcmp(backend, "hbp"))
+		backend = "kprobe";
+
+	if (!strcmp(backend, "hbp")) {
+		hook->type = HOOK_HBP;
+		hook->hbp = hbp_on_exec(funcname, hook_hbp_handler, hook);
+		ret = IS_ERR(hook->hbp) ? PTR_ERR(hook->hbp) : 0;
+	} else if (!strcmp(backend, "kprobe")) {
+		hook->type = HOOK_KPROBE;
+		hook->kp.symbol_name = funcname;
+		hook->kp.pre_handler = hook_kprobe_handler;
+		ret = register_kprobe(&hook->kp);
+	} else if (!strcmp(backend, "ftrace")) {
+		hook->type = HOOK_FTRACE;
+		ret = hook_ftrace_register(hook, funcname);
+	} else {
+		ret = -EINVAL;
+	}
+
+	if (ret) {
+		kfree(hook);
+		return ERR_PTR(ret);
+	}
+
+	return hook;
+}
+
+void hook_clear(struct hook *hook)
+{
+	switch (hook->type) {
+	case HOOK_HBP:
+		hbp_clear(hook->hbp);
+		break;
+	case HOOK_KPROBE:
+		unregister_kprobe(&hook->kp);
+		break;
+	case HOOK_FTRACE:
+		hook_ftrace_unregister(hook);
+		break;
+	}
+
+	/*
+	 * Handlers in flight run with interrupts disabled. Only from 4.20
+	 * synchronize_rcu waits for such sections on PREEMPT_RCU kernels,
+	 * before it they are sched RCU readers. The hbp one is not covered
+	 * by the unregister itself, so don't rely on the backends.
+	 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,20,0)
+	synchronize_sched();
+#else
+	synchronize_rcu();
+#endif
+	kfree(hook);
+}
+
+ulong hook_first_arg(const struct pt_regs *regs)
+{
+	/* every backend fires at the function entry, arguments are in place */
+#ifdef CONFIG_X86_64
+	return regs->di;
+#else
+	return regs->ax;	/* i386 kernels are built with -mregparm=3 */
+#endif
+}
@@ -0,0 +1,102 @@
+/**
+ * @file hookbench.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief microbenchmark of the paths rkcd.ko hooks, see bench.sh
+ *
+ * write  - write(2) of one byte to /dev/null, hits the vfs write hook;
+ * wakeup - futex ping-pong of two threads, every round trip is two
+ *          try_to_wake_up calls and no writes.
+ *
+ * Usage: hookbench [iterations]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static atomic_int turn;
+static long iterations;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void futex(atomic_int *addr, const int op, const int val)
+{
+	syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+/* wait for our turn, then pass it to the other thread */
+static void pingpong(const int me)
+{
+	long i;
+
+	for (i = 0; i < iterations; i++) {
+		while (atomic_load(&turn) != me)
+			futex(&turn, FUTEX_WAIT_PRIVATE, !me);
+		atomic_store(&turn, !me);
+		futex(&turn, FUTEX_WAKE_PRIVATE, 1);
+	}
+}
+
+static void *pong(void *arg)
+{
+	pingpong(1);
+	return NULL;
+}
+
+static double bench_write(void)
+{
+	int fd = open("/dev/null", O_WRONLY);
+	double start;
+	long i;
+
+	if (fd < 0) {
+		perror("open");
+		exit(1);
+	}
+
+	start = now();
+	for (i = 0; i < iterations; i++) {
+		if (write(fd, "", 1) != 1) {
+			perror("write");
+			exit(1);
+		}
+	}
+
+	close(fd);
+	return (now() - start) / iterations;
+}
+
+static double bench_wakeup(void)
+{
+	pthread_t thread;
+	double start;
+
+	start = now();
+	pthread_create(&thread, NULL, pong, NULL);
+	pingpong(0);
+	pthread_join(thread, NULL);
+
+	return (now() - start) / (2 * iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	iterations = argc > 1 ? strtol(argv[1], NULL, 0) : 1000000;
+
+	printf("write\t%.1f ns\n", bench_write());
+	printf("wakeup\t%.1f ns\n", bench_wakeup());
+	return 0;
+}
@@ -56,7 +56,8 @@ int __must_check is_kernel_address_valid(ulong addr)
 
 struct perf_event * __percpu *  __must_check hbp_on_exec(
 	const char *const funcname,
-	const perf_overflow_handler_t handler)
+	const perf_overflow_handler_t handler,
+	void *context)
 {
 	struct perf_event_attr attr;
 	hw_breakpoint_init(&attr);
@@ -68,7 +69,7 @@ struct perf_event * __percpu *  __must_check hbp_on_exec(
 	attr.bp_len = HW_BREAKPOINT_LEN_8;
 	attr.bp_type = HW_BREAKPOINT_X;
 
-	return register_wide_hw_breakpoint(&attr, handler, NULL);
+	return register_wide_hw_breakpoint(&attr, handler, context);
 }
 
 void hbp_clear(struct perf_event * __percpu *hbp)
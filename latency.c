@@ -0,0 +1,138 @@
+/**
+ * @file latency.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief latency histograms of the hook handlers
+ *
+ * Handlers record the cycles they spent into per-cpu log2 histograms,
+ * which are summed up in /proc/rootkiticide_latency. Writing anything
+ * to the file resets the histograms.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+#include "rootkiticide.h"
+
+#define LATENCY_BUCKETS 40	/* bucket i counts [2^i, 2^(i+1)) cycles */
+
+struct latency_hist {
+	u64 count[LATENCY_BUCKETS];
+	u64 total;		/* cycles */
+	u64 max;
+};
+
+static DEFINE_PER_CPU(struct latency_hist [LATENCY_HOOKS], latency);
+
+const char *const latency_hook_names[] = {
+	[LATENCY_TRY_TO_WAKE_UP] = "try_to_wake_up",
+	[LATENCY_WAKE_UP_NEW_TASK] = "wake_up_new_task",
+	[LATENCY_VFS_WRITE] = "__vfs_write",
+	[LATENCY_VFS_WRITEV] = "vfs_writev",
+	[LATENCY_WATCH] = "watch",
+};
+
+/*
+ * Called at the end of a handler, which runs with interrupts disabled,
+ * so this_cpu ops are enough.
+ */
+void latency_record(const enum latency_hook hook, const cycles_t start)
+{
+	u64 cycles = get_cycles() - start;
+	uint bucket = cycles ? min(ilog2(cycles), LATENCY_BUCKETS - 1) : 0;
+
+	this_cpu_inc(latency[hook].count[bucket]);
+	this_cpu_add(latency[hook].total, cycles);
+	if (cycles > this_cpu_read(latency[hook].max))
+		this_cpu_write(latency[hook].max, cycles);
+}
+
+static void latency_sum(const enum latency_hook hook,
+			struct latency_hist *sum)
+{
+	struct latency_hist *h;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		h = &per_cpu(latency, cpu)[hook];
+		for (i = 0; i < LATENCY_BUCKETS; i++)
+			sum->count[i] += READ_ONCE(h->count[i]);
+		sum->total += READ_ONCE(h->total);
+		sum->max = max(sum->max, READ_ONCE(h->max));
+	}
+}
+
+static int latency_show(struct seq_file *s, void *v)
+{
+	struct latency_hist sum;
+	u64 count;
+	int hook, i;
+
+	seq_printf(s, "hook\tcount\ttotal\tmax\n");
+	for (hook = 0; hook < LATENCY_HOOKS; hook++) {
+		latency_sum(hook, &sum);
+		for (count = 0, i = 0; i < LATENCY_BUCKETS; i++)
+			count += sum.count[i];
+		seq_printf(s, "%s\t%llu\t%llu\t%llu\n", latency_hook_names[hook],
+			   count, sum.total, sum.max);
+	}
+
+	/* non-empty buckets only, cycles is the lower bound */
+	seq_printf(s, "\nhook\tcycles\tcount\n");
+	for (hook = 0; hook < LATENCY_HOOKS; hook++) {
+		latency_sum(hook, &sum);
+		for (i = 0; i < LATENCY_BUCKETS; i++) {
+			if (sum.count[i])
+				seq_printf(s, "%s\t%llu\t%llu\n",
+					   latency_hook_names[hook],
+					   i ? 1ULL << i : 0, sum.count[i]);
+		}
+	}
+
+	return 0;
+}
+
+/* concurrent handlers may leave a sample of the previous period */
+static ssize_t latency_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(latency, cpu), 0, sizeof(per_cpu(latency, cpu)));
+
+	return count;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, NULL);
+}
+
+static const struct file_operations latency_fops = {
+	.owner = THIS_MODULE,
+	.open = latency_open,
+	.read = seq_read,
+	.write = latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int __must_check latency_init(void)
+{
+	if (!proc_create(PROCNAME "_latency", 0600, NULL, &latency_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+void latency_cleanup(void)
+{
+	remove_proc_entry(PROCNAME "_latency", NULL);
+}
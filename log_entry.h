@@ -0,0 +1,121 @@
+/**
+ * @file log_entry.h
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief layout of the records stored in the ring buffer
+ *
+ * Every record starts with struct log_entry and is followed by the
+ * payload of its type. Records are variable-length, log_entry.size
+ * holds the size of the whole record (header included).
+ *
+ * Records are exported as is (little-endian), so the layout is an ABI
+ * with rkcdcli: bump LOG_STREAM_VERSION on changes.
+ */
+
+#pragma once
+
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/socket.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <asm/byteorder.h>
+
+#ifdef __BIG_ENDIAN
+#error "records are exported in little-endian"
+#endif
+
+#define LOG_STREAM_MAGIC 0x62636b72	/* "rkcb" */
+#define LOG_STREAM_VERSION 6
+
+/* starts the binary stream, followed by the records */
+struct log_stream_header {
+	u32 magic;
+	u16 version;
+	u16 entry_size;		/* sizeof(struct log_entry) */
+} __attribute__((packed));
+
+enum log_type {
+	LOG_SOCKET,
+	LOG_FILE,
+	LOG_PROCESS,
+	LOG_REPEAT,
+	LOG_SEEN,
+	LOG_HIDDEN,
+	LOG_SAMPLING,
+	LOG_WATCH
+};
+
+/*
+ * Common part, the only content of LOG_PROCESS records.
+ * (ts, cpu, seq) orders records of all cpus without a shared counter,
+ * seq has no gaps within a cpu unless records were lost.
+ */
+struct log_entry {
+	u16 size;		/* whole record size */
+	u8 type;		/* enum log_type */
+	u8 reserved;
+	u32 seq;		/* per cpu */
+	u64 ts;			/* local_clock(), ns */
+	u32 cpu;
+	pid_t pid;
+	pid_t tgid;
+	char comm[TASK_COMM_LEN];
+} __attribute__((packed));
+
+struct log_socket_entry {
+	struct log_entry common;
+	u32 cookie;		/* identifies the socket within the tgid */
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in;	/* AF_INET, record is cut after it */
+		struct sockaddr_in6 in6;
+	} saddr;
+} __attribute__((packed));
+
+struct log_file_entry {
+	struct log_entry common;
+	u32 cookie;		/* identifies the open file within the tgid */
+	char filename[];	/* null-terminated, sized to the actual path */
+} __attribute__((packed));
+
+/* duplicates of a file/socket record suppressed by the dedup cache */
+struct log_repeat_entry {
+	struct log_entry common;
+	u32 cookie;		/* cookie of the repeated record */
+	u32 count;		/* times seen after it was logged */
+	pid_t tgid;		/* tgid of the repeated record */
+	u8 type;		/* type of the repeated record */
+} __attribute__((packed));
+
+/* object of the aggregation mode, followed by its file/socket/process record */
+struct log_seen_entry {
+	struct log_entry common;	/* the same as of the object record */
+	u32 hits;
+	u64 first;		/* local_clock() of the first and the last hit */
+	u64 last;
+} __attribute__((packed));
+
+#define HIDDEN_PID_LOOKUP 1	/* not found by its pid */
+#define HIDDEN_TASK_LIST 2	/* not in the task list */
+
+/* running task missing from the system views, see crossview.c */
+struct log_hidden_entry {
+	struct log_entry common;	/* of the hidden task */
+	u8 missing;		/* HIDDEN_* */
+} __attribute__((packed));
+
+/* a hook of the cpu was sampled in the last interval, see governor.c */
+struct log_sampling_entry {
+	struct log_entry common;	/* of the task that ended the interval */
+	u8 hook;		/* enum latency_hook */
+	u8 level;		/* 1 in 2^level events logged, 0 - all from now */
+	u32 skipped;		/* events not logged in the interval */
+	u32 load;		/* permille of the cpu taken by the handlers */
+} __attribute__((packed));
+
+/* a function watched through /proc/rootkiticide_hooks was called */
+struct log_watch_entry {
+	struct log_entry common;	/* of the calling task */
+	char funcname[];	/* null-terminated, sized to the actual name */
+} __attribute__((packed));
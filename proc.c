@@ -7,83 +7,357 @@
 
 #include <linux/module.h>
 #include <linux/version.h>
+#include <linux/sched.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/clock.h>
+#endif
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/list.h>
 #include <linux/net.h>
+#include <linux/hash.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/jiffies.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/irq_work.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/uaccess.h>
+#include <linux/kallsyms.h>
 
 #include "rootkiticide.h"
 #include "ringbuf.h"
 
 spinlock_t log_queue_lock;
 LIST_HEAD(log_queue);
-atomic_t counter = ATOMIC_INIT(0);
 
-struct ringbuf rbuf = {
-	.head = ATOMIC_INIT(0),
-	.tail = ATOMIC_INIT(0)
-};
+/* records of the cpu, ringbuf keeps their order within a cpu */
+static DEFINE_PER_CPU(u32, log_seq);
 
-static pid_t proc_reader = 0;
+static bool log_before(const void *a, const void *b)
+{
+	const struct log_entry *x = a, *y = b;
+	return x->ts < y->ts;
+}
 
-enum log_type {
-	LOG_SOCKET,
-	LOG_FILE,
-	LOG_PROCESS
+struct ringbuf_set rbuf = {
+	.before = log_before
 };
 
-struct log_entry {
-	struct list_head list;
-	ulong id;
-	enum log_type log_type;
-	struct {
-		/* must be filled for all */
-		pid_t pid;
-		pid_t tgid;
-		char comm[TASK_COMM_LEN];
-	} common;
-	struct {
-		/* filled only for LOG_SOCKET */
-		struct sockaddr_storage saddr;
-	} socket;
-	struct {
-		/* filled only for LOG_FILE */
-		char filename[PATH_MAX + 1];
-	} file;
+static uint ring_size = 512;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size,
+		 "KiB of the ring of every cpu");
+
+static uint ring_block_size = 32;
+module_param(ring_block_size, uint, 0444);
+MODULE_PARM_DESC(ring_block_size,
+		 "KiB of a ring block, the unit of reading and overwriting "
+		 "(raised to fit the biggest record or 1024 blocks a ring)");
+
+static uint dedup_window = 1000;
+module_param(dedup_window, uint, 0644);
+MODULE_PARM_DESC(dedup_window,
+		 "suppress repeated file/socket records of a task within "
+		 "this many milliseconds (0 - log every occurrence)");
+
+#define DEDUP_SLOTS 256		/* Must be a power of 2 */
+#define DEDUP_SLOT_BITS 8	/* ilog2(DEDUP_SLOTS) */
+
+/* recently logged file/socket of a task */
+struct dedup_slot {
+	pid_t tgid;
+	u32 cookie;
+	u8 type;
+	u16 gen;		/* bumped for every object taking the slot */
+	u32 count;		/* duplicates suppressed since logged */
+	const void *object;
+	ulong object_gen;	/* e.g. dentry of a struct file */
+	ulong stamp;		/* jiffies when logged */
 };
 
+static DEFINE_PER_CPU(struct dedup_slot [DEDUP_SLOTS], dedup_cache);
+
+static uint poll_watermark = 25;
+module_param(poll_watermark, uint, 0644);
+MODULE_PARM_DESC(poll_watermark,
+		 "wake up readers when a cpu ring is filled by this percent");
+
+static uint poll_timeout = 1000;
+module_param(poll_timeout, uint, 0644);
+MODULE_PARM_DESC(poll_timeout,
+		 "wake up readers of any data after this many milliseconds");
+
+static DECLARE_WAIT_QUEUE_HEAD(log_wait);
+
+/*
+ * Wakeups can't be done from the hook context, so they are deferred
+ * to irq_work. Only one is done until the readers read.
+ */
+static struct irq_work log_wakeup_work;
+static atomic_t log_wakeup_pending = ATOMIC_INIT(0);
+static atomic_t log_timed_out = ATOMIC_INIT(0);
+
+static void log_timeout_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(log_timeout_work, log_timeout_fn);
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3,10,0)
 /* introduced in 6d7581e62f8be462440d7b22c6361f7c9fa4902b */
 #define list_first_entry_or_null(ptr, type, member) \
 	(!list_empty(ptr) ? list_first_entry(ptr, type, member) : NULL)
 #endif
 
+static void log_wakeup(struct irq_work *work)
+{
+	wake_up_interruptible(&log_wait);
+}
+
+static bool log_over_watermark(const ulong fill)
+{
+	return fill * 100 >= (ulong)poll_watermark * ringbuf_size();
+}
+
+/* ringbuf_written at the last read, readers don't share a position */
+static DEFINE_PER_CPU(u32, log_wakeup_mark);
+
+static u32 log_written_since_read(const int cpu)
+{
+	return ringbuf_written(per_cpu_ptr(rbuf.rbs, cpu))
+		- per_cpu(log_wakeup_mark, cpu);
+}
+
+/* called from the hooks after each commit */
+static void log_wakeup_check(const int cpu)
+{
+	if (!waitqueue_active(&log_wait) || atomic_read(&log_wakeup_pending))
+		return;
+
+	if (log_over_watermark(log_written_since_read(cpu))
+	    && !atomic_xchg(&log_wakeup_pending, 1))
+		irq_work_queue(&log_wakeup_work);
+}
+
+static void log_dedup_sweep(void *all);
+
+/*
+ * Make partially written blocks readable if someone waits for them,
+ * log the duplicates of the expired dedup slots.
+ */
+static void log_timeout_fn(struct work_struct *work)
+{
+	struct ringbuf *rb;
+	int cpu;
+	bool data = false;
+
+	if (dedup_window && !aggregate)
+		on_each_cpu(log_dedup_sweep, NULL, 1);
+
+	if (waitqueue_active(&log_wait)) {
+		for_each_possible_cpu(cpu) {
+			rb = per_cpu_ptr(rbuf.rbs, cpu);
+			if (log_written_since_read(cpu)) {
+				ringbuf_flush(rb);
+				data = true;
+			}
+		}
+
+		if (data) {
+			atomic_set(&log_timed_out, 1);
+			wake_up_interruptible(&log_wait);
+		}
+	}
+
+	schedule_delayed_work(&log_timeout_work,
+			      msecs_to_jiffies(max(poll_timeout, 10U)));
+}
+
+/* fill of the rings for the consuming reader or lag of the cursors */
+static uint log_poll_cursors(struct file *file, poll_table *wait,
+			     const struct ringbuf_cursor *const cursors)
+{
+	int cpu;
+	bool timed_out;
+	ulong fill;
+
+	poll_wait(file, &log_wait, wait);
+
+	timed_out = atomic_read(&log_timed_out);
+	for_each_possible_cpu(cpu) {
+		struct ringbuf *rb = per_cpu_ptr(rbuf.rbs, cpu);
+		fill = cursors ? ringbuf_cursor_lag(rb, &cursors[cpu])
+			: ringbuf_fill(rb);
+		if (log_over_watermark(fill) || (timed_out && fill))
+			return POLLIN | POLLRDNORM;
+	}
+
+	return 0;
+}
+
+uint log_poll(struct file *file, poll_table *wait)
+{
+	return log_poll_cursors(file, wait, NULL);
+}
+
+/* readers are reading, so rearm the wakeups */
+void log_poll_rearm(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		per_cpu(log_wakeup_mark, cpu) =
+			ringbuf_written(per_cpu_ptr(rbuf.rbs, cpu));
+
+	atomic_set(&log_timed_out, 0);
+	atomic_set(&log_wakeup_pending, 0);
+}
+
+/* the largest record, a file one with the full path */
+#define LOG_ENTRY_MAX (sizeof(struct log_file_entry) + PATH_MAX + 1)
+
+/*
+ * Procfs readers don't consume, each reads the rings with its own
+ * cursors, so any number of them read everything independently.
+ */
+struct proc_reader_state {
+	struct list_head list;		/* in proc_readers */
+	pid_t tgid;
+	struct mutex lock;		/* serializes reads of the binary file */
+	struct ringbuf_set_cursor *cursor;
+	int cpu;			/* ring of the peeked entry */
+	bool pending;			/* the copy is not shown yet */
+	u8 entry[LOG_ENTRY_MAX];	/* copy of the entry being shown */
+};
+
+static LIST_HEAD(proc_readers);
+static DEFINE_MUTEX(proc_readers_lock);
+
+static int __must_check proc_reader_init(struct proc_reader_state *state)
+{
+	state->cursor = ringbuf_set_cursor_alloc(&rbuf);
+	if (!state->cursor)
+		return -ENOMEM;
+
+	mutex_init(&state->lock);
+	state->tgid = current->tgid;
+
+	mutex_lock(&proc_readers_lock);
+	list_add(&state->list, &proc_readers);
+	mutex_unlock(&proc_readers_lock);
+	return 0;
+}
+
+static void proc_reader_free(struct proc_reader_state *state)
+{
+	mutex_lock(&proc_readers_lock);
+	list_del(&state->list);
+	mutex_unlock(&proc_readers_lock);
+
+	ringbuf_set_cursor_free(state->cursor);
+}
+
+/* the entry is a valid record of the size */
+static bool proc_entry_valid(const void *e, const size_t size)
+{
+	return size >= sizeof(struct log_entry) && size <= LOG_ENTRY_MAX
+		&& ((const struct log_entry *)e)->size == size;
+}
+
+/* copy the next intact entry, false if there are no more */
+static bool proc_reader_next(struct proc_reader_state *state)
+{
+	size_t size;
+	void *e;
+
+	while ((e = ringbuf_set_cursor_peek(&rbuf, state->cursor,
+					    &state->cpu, &size))) {
+		memcpy(state->entry, e, min_t(size_t, size, LOG_ENTRY_MAX));
+		if (ringbuf_set_cursor_consume(&rbuf, state->cursor,
+					       state->cpu)
+		    && proc_entry_valid(state->entry, size))
+			return true;
+	}
+
+	return false;
+}
+
 static void *proc_seq_start(struct seq_file *s, loff_t *pos)
 {
-	return ringbuf_read(&rbuf);
+	struct proc_reader_state *state = s->private;
+
+	log_poll_rearm();
+
+	/* the copy is kept until it is shown */
+	if (!state->pending)
+		state->pending = proc_reader_next(state);
+
+	return state->pending ? state->entry : NULL;
 }
 
+static const char *const log_type_names[] = {
+	[LOG_SOCKET] = "socket",
+	[LOG_FILE] = "file",
+	[LOG_PROCESS] = "process",
+	[LOG_REPEAT] = "repeat",
+	[LOG_SEEN] = "seen",
+	[LOG_HIDDEN] = "hidden",
+	[LOG_SAMPLING] = "sampling",
+	[LOG_WATCH] = "watch",
+};
+
 static int proc_seq_show(struct seq_file *s, void *v)
 {
 	struct log_entry *e = v;
 
 	seq_printf(s, "{ ");
 	/* TODO escape comm */
-	seq_printf(s, "\"id\": %lu, \"pid\": %d, \"tgid\": %d, \"comm\": \"%s\"",
-		   e->id, e->common.pid, e->common.tgid, e->common.comm);
-	switch (e->log_type) {
+	seq_printf(s, "\"seq\": %u, \"ts\": %llu, \"cpu\": %u, "
+		   "\"type\": \"%s\", \"pid\": %d, \"tgid\": %d, "
+		   "\"comm\": \"%s\"",
+		   e->seq, e->ts, e->cpu, log_type_names[e->type], e->pid,
+		   e->tgid, e->comm);
+	switch (e->type) {
 	case LOG_PROCESS:
 		/* current no additional record info */
 		break;
 	case LOG_FILE:
 		/* TODO escape filename */
-		seq_printf(s, ", \"filename\": \"%s\"", e->file.filename);
+		seq_printf(s, ", \"cookie\": %u, \"filename\": \"%s\"",
+			   ((struct log_file_entry *)e)->cookie,
+			   ((struct log_file_entry *)e)->filename);
 		break;
 	case LOG_SOCKET:
-		seq_printf(s, ", \"saddr\": \"%pISpc\"", &e->socket.saddr);
+		seq_printf(s, ", \"cookie\": %u, \"saddr\": \"%pISpc\"",
+			   ((struct log_socket_entry *)e)->cookie,
+			   &((struct log_socket_entry *)e)->saddr.sa);
+		break;
+	case LOG_HIDDEN:
+		seq_printf(s, ", \"missing\": %u",
+			   ((struct log_hidden_entry *)e)->missing);
+		break;
+	case LOG_SAMPLING: {
+		struct log_sampling_entry *r = v;
+		seq_printf(s, ", \"hook\": \"%s\", \"level\": %u, "
+			   "\"skipped\": %u, \"load\": %u",
+			   latency_hook_names[r->hook], r->level, r->skipped,
+			   r->load);
+		break;
+	}
+	case LOG_WATCH:
+		seq_printf(s, ", \"hook\": \"%s\"",
+			   ((struct log_watch_entry *)e)->funcname);
+		break;
+	case LOG_REPEAT: {
+		struct log_repeat_entry *r = v;
+		seq_printf(s, ", \"cookie\": %u, \"count\": %u, "
+			   "\"repeat_tgid\": %d, \"repeat_type\": \"%s\"",
+			   r->cookie, r->count, r->tgid,
+			   log_type_names[r->type]);
 		break;
 	}
+	}
 	seq_printf(s, " }\n");
 
 	return 0;
@@ -91,7 +365,11 @@ static int proc_seq_show(struct seq_file *s, void *v)
 
 static void *proc_seq_next(struct seq_file *s, void *v, loff_t *pos)
 {
-	return ringbuf_read(&rbuf);
+	struct proc_reader_state *state = s->private;
+
+	state->pending = proc_reader_next(state);
+	++*pos;
+	return state->pending ? state->entry : NULL;
 }
 
 static void proc_seq_stop(struct seq_file *s, void *v)
@@ -107,8 +385,39 @@ static const struct seq_operations proc_seq_ops = {
 
 static int proc_open(struct inode *inode, struct  file *file)
 {
-	proc_reader = current->real_parent->pid;
-	return seq_open(file, &proc_seq_ops);
+	int ret = reader_acquire(file, false);
+	if (ret)
+		return ret;
+
+	ret = seq_open_private(file, &proc_seq_ops,
+			       sizeof(struct proc_reader_state));
+	if (ret) {
+		reader_release(file, false);
+		return ret;
+	}
+
+	ret = proc_reader_init(((struct seq_file *)file->private_data)->private);
+	if (ret) {
+		seq_release_private(inode, file);
+		reader_release(file, false);
+	}
+
+	return ret;
+}
+
+static int proc_release(struct inode *inode, struct file *file)
+{
+	proc_reader_free(((struct seq_file *)file->private_data)->private);
+	reader_release(file, false);
+	return seq_release_private(inode, file);
+}
+
+static uint proc_poll(struct file *file, poll_table *wait)
+{
+	struct proc_reader_state *state =
+		((struct seq_file *)file->private_data)->private;
+
+	return log_poll_cursors(file, wait, state->cursor->cursors);
 }
 
 static const struct file_operations proc_fops = {
@@ -116,97 +425,593 @@ static const struct file_operations proc_fops = {
 	.open = proc_open,
 	.read = seq_read,
 	.llseek = seq_lseek,
-	.release = seq_release,
+	.release = proc_release,
+	.poll = proc_poll,
 };
 
-static int __must_check is_reader_or_child(void)
+const struct log_stream_header log_stream_header = {
+	.magic = LOG_STREAM_MAGIC,
+	.version = LOG_STREAM_VERSION,
+	.entry_size = sizeof(struct log_entry),
+};
+
+/*
+ * Binary stream: the header followed by records as they are stored,
+ * copied straight to the user buffer, as many as fit in it.
+ */
+static ssize_t proc_bin_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
 {
-	struct task_struct *t, *prev;
-	t = current;
-	do {
-		if (t->pid == proc_reader)
-			return true;
+	struct proc_reader_state *state = file->private_data;
+	void *e;
+	size_t done = 0, size;
+	ssize_t err = 0;
+	bool valid;
+
+	if (!*ppos) {
+		if (count < sizeof(log_stream_header))
+			return -EINVAL;
+		if (copy_to_user(buf, &log_stream_header,
+				 sizeof(log_stream_header)))
+			return -EFAULT;
+		done = sizeof(log_stream_header);
+	}
+
+	mutex_lock(&state->lock);
+	log_poll_rearm();
+	while ((e = ringbuf_set_cursor_peek(&rbuf, state->cursor, &state->cpu,
+					    &size))) {
+		if (done + size > count) {
+			/* the buffer must fit at least one record */
+			err = -EINVAL;
+			break;
+		}
+
+		/* copied in place, an overwritten copy is not counted */
+		valid = proc_entry_valid(e, size);
+		if (copy_to_user(buf + done, e, size)) {
+			err = -EFAULT;
+			break;
+		}
+
+		if (ringbuf_set_cursor_consume(&rbuf, state->cursor,
+					       state->cpu) && valid)
+			done += size;
+	}
+	mutex_unlock(&state->lock);
 
-		prev = t;
-		t = t->real_parent;
-	} while (prev->pid != 0);
+	if (!done && err)
+		return err;
 
-	return false;
+	*ppos += done;
+	return done;
+}
+
+static int proc_bin_open(struct inode *inode, struct file *file)
+{
+	int ret = reader_acquire(file, false);
+	if (ret)
+		return ret;
+
+	file->private_data = kzalloc(sizeof(struct proc_reader_state),
+				     GFP_KERNEL);
+	if (!file->private_data) {
+		reader_release(file, false);
+		return -ENOMEM;
+	}
+
+	ret = proc_reader_init(file->private_data);
+	if (ret) {
+		kfree(file->private_data);
+		reader_release(file, false);
+		return ret;
+	}
+
+	return nonseekable_open(inode, file);
+}
+
+static int proc_bin_release(struct inode *inode, struct file *file)
+{
+	proc_reader_free(file->private_data);
+	kfree(file->private_data);
+	reader_release(file, false);
+	return 0;
+}
+
+static uint proc_bin_poll(struct file *file, poll_table *wait)
+{
+	struct proc_reader_state *state = file->private_data;
+
+	return log_poll_cursors(file, wait, state->cursor->cursors);
+}
+
+static const struct file_operations proc_bin_fops = {
+	.owner = THIS_MODULE,
+	.open = proc_bin_open,
+	.read = proc_bin_read,
+	.llseek = no_llseek,
+	.release = proc_bin_release,
+	.poll = proc_bin_poll,
+};
+
+static int stats_show(struct seq_file *s, void *v)
+{
+	struct proc_reader_state *state;
+	struct ringbuf *rb;
+	ulong lag, lost;
+	int cpu;
+
+	seq_printf(s, "cpu\tfill\tsize\treserved\tbytes\toverwritten"
+		   "\twraps\tspins\tswitch_failed\n");
+	for_each_possible_cpu(cpu) {
+		rb = per_cpu_ptr(rbuf.rbs, cpu);
+		seq_printf(s, "%d\t%lu\t%lu\t%lld\t%lld\t%d\t%d\t%d\t%d\n",
+			   cpu, ringbuf_fill(rb), ringbuf_size(),
+			   atomic64_read(&rb->stats.reserved),
+			   atomic64_read(&rb->stats.bytes),
+			   atomic_read(&rb->overwritten),
+			   atomic_read(&rb->stats.wraps),
+			   atomic_read(&rb->stats.spins),
+			   atomic_read(&rb->stats.switch_failed));
+	}
+
+	/* procfs readers, bytes behind writers and skipped as overwritten */
+	seq_printf(s, "\nreader\tlag\tlost\n");
+	mutex_lock(&proc_readers_lock);
+	list_for_each_entry(state, &proc_readers, list) {
+		lag = lost = 0;
+		for_each_possible_cpu(cpu) {
+			lag += ringbuf_cursor_lag(per_cpu_ptr(rbuf.rbs, cpu),
+						  &state->cursor->cursors[cpu]);
+			lost += READ_ONCE(state->cursor->cursors[cpu].lost);
+		}
+		seq_printf(s, "%d\t%lu\t%lu\n", state->tgid, lag, lost);
+	}
+	mutex_unlock(&proc_readers_lock);
+
+	/* entries that did not fit the fixed size sets */
+	seq_printf(s, "\nset\tslots\tdropped\n");
+	reader_stats(s);
+	crossview_stats(s);
+	aggr_stats(s);
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Fill common log record info. Writers of a cpu ring run with irqs
+ * disabled, so seq follows the order of the records in the ring.
+ */
+static void log_fill(struct log_entry *entry, const enum log_type type,
+		     const struct commit_s *commit,
+		     const struct task_struct *task)
+{
+	entry->size = commit->size;
+	entry->type = type;
+	entry->reserved = 0;
+	entry->seq = per_cpu(log_seq, commit->cpu)++;
+	entry->ts = local_clock();
+	entry->cpu = commit->cpu;
+	entry->pid = task->pid;
+	entry->tgid = task->tgid;
+	memcpy(&entry->comm, task->comm, sizeof(entry->comm));
+}
+
+#define LOG_BATCH_MAX 8192
+
+/*
+ * Records of a cpu staged to be reserved in the ring at once, see
+ * log_batch_begin. All records of the cpu go through it while it is
+ * open, so their order in the ring is kept.
+ */
+struct log_batch {
+	bool open;
+	size_t len;		/* of the staged records */
+	size_t bytes;		/* they take in the ring */
+	u8 buf[LOG_BATCH_MAX];
+};
+
+static struct log_batch __percpu *log_batch;
+
+static bool log_staged(const struct log_batch *const batch,
+		       const void *const entry)
+{
+	return entry >= (void *)batch->buf
+		&& entry < (void *)batch->buf + LOG_BATCH_MAX;
+}
+
+static void log_batch_flush(struct log_batch *const batch)
+{
+	struct ringbuf_batch rb_batch;
+	struct log_entry *entry;
+	size_t off;
+
+	if (!batch->len)
+		return;
+
+	ringbuf_set_reserve_batch(&rbuf, &rb_batch, batch->bytes);
+	for (off = 0; off < batch->len; off += entry->size) {
+		entry = (struct log_entry *)(batch->buf + off);
+		memcpy(ringbuf_batch_entry(&rb_batch, entry->size), entry,
+		       entry->size);
+	}
+	ringbuf_set_commit_batch(&rbuf, &rb_batch);
+	log_wakeup_check(rb_batch.commit.cpu);
+
+	batch->len = 0;
+	batch->bytes = 0;
+}
+
+/* reserve in the ring or in the open batch of the cpu */
+static void *log_reserve(struct commit_s *commit)
+{
+	struct log_batch *batch = this_cpu_ptr(log_batch);
+	size_t bytes = ringbuf_batch_size(commit->size);
+	size_t max = min_t(size_t, LOG_BATCH_MAX, ringbuf_batch_max());
+	void *entry;
+
+	if (!batch->open)
+		return ringbuf_set_reserve(&rbuf, commit);
+
+	if (batch->bytes + bytes > max)
+		log_batch_flush(batch);
+
+	/* too big for a batch, goes after the flushed ones */
+	if (bytes > max)
+		return ringbuf_set_reserve(&rbuf, commit);
+
+	commit->cpu = raw_smp_processor_id();
+	entry = batch->buf + batch->len;
+	batch->len += commit->size;
+	batch->bytes += bytes;
+	return entry;
+}
+
+/**
+ * Stage the records of current cpu until log_batch_end, then reserve
+ * them in the ring with a tail update per LOG_BATCH_MAX bytes instead
+ * of one per record. Used for walks that log many records at once.
+ *
+ * Must be called with irqs disabled, like the hook handlers are.
+ */
+void log_batch_begin(void)
+{
+	this_cpu_ptr(log_batch)->open = true;
+}
+
+void log_batch_end(void)
+{
+	struct log_batch *batch = this_cpu_ptr(log_batch);
+
+	log_batch_flush(batch);
+	batch->open = false;
 }
 
 static int __must_check log_common(struct log_entry *entry,
+				   const enum log_type type,
 				   const struct commit_s *commit)
 {
-	/*
-	if (proc_reader && is_reader_or_child()) {
-		kfree(entry);
+	log_fill(entry, type, commit, current);
+
+	/* staged records are committed by log_batch_flush */
+	if (log_staged(this_cpu_ptr(log_batch), entry))
 		return 0;
-	}
-	*/
 
-	/* fill common log record info */
-	entry->common.pid = current->pid;
-	entry->common.tgid = current->tgid;
-	memcpy(&entry->common.comm, current->comm, sizeof(entry->common.comm));
+	ringbuf_set_commit(&rbuf, commit);
+	log_wakeup_check(commit->cpu);
+	return 0;
+}
 
-	entry->id = atomic_read(&counter);
-	atomic_inc(&counter);
+static int __must_check log_repeat(const struct dedup_slot *const slot)
+{
+	struct commit_s commit = { .size = sizeof(struct log_repeat_entry) };
+	struct log_repeat_entry *entry = log_reserve(&commit);
+	if (!entry)
+		return -EFAULT;
 
-	ringbuf_commit(&rbuf, commit);
-	return 0;
+	entry->cookie = slot->cookie;
+	entry->count = slot->count;
+	entry->tgid = slot->tgid;
+	entry->type = slot->type;
+	return log_common(&entry->common, LOG_REPEAT, &commit);
 }
 
-int __must_check log_socket(const struct sockaddr_storage *const saddr)
+static bool log_dedup_expired(const struct dedup_slot *const slot)
 {
-	struct commit_s commit = { .size = sizeof(struct log_entry) };
-	struct log_entry *entry = ringbuf_reserve(&rbuf, &commit);
+	return !time_before(jiffies,
+			    slot->stamp + msecs_to_jiffies(dedup_window));
+}
+
+/*
+ * Log the duplicates suppressed in the expired slots of the cpu, or in
+ * all of them if all is set. Runs with irqs disabled, like the hooks.
+ */
+static void log_dedup_sweep(void *all)
+{
+	struct dedup_slot *slots = this_cpu_ptr(dedup_cache);
+	uint i;
+
+	for (i = 0; i < DEDUP_SLOTS; i++) {
+		if (!slots[i].count || (!all && !log_dedup_expired(&slots[i])))
+			continue;
+
+		WARN_ON(log_repeat(&slots[i]));
+		slots[i].count = 0;
+	}
+}
+
+/**
+ * Check a file/socket of current task against the dedup cache.
+ *
+ * The cache is per-CPU and direct-mapped by (tgid, object, gen), gen
+ * tells apart a reused object (e.g. dentry of a struct file). The
+ * cookie is made of the slot index and a generation of the slot bumped
+ * for every new object, so it is not reused while the record can be
+ * repeated. The number of suppressed duplicates is logged as LOG_REPEAT
+ * record when the slot expires (see log_dedup_sweep) or is reused.
+ *
+ * @return true if the record must not be logged.
+ */
+bool __must_check log_seen(const enum log_type type, const void *const object,
+			   const ulong gen, u32 *const cookie)
+{
+	struct dedup_slot *slot;
+	pid_t tgid = current->tgid;
+	uint i = hash_long((ulong)object ^ gen ^ tgid, DEDUP_SLOT_BITS);
+	bool seen = false;
+
+	slot = &get_cpu_var(dedup_cache)[i];
+	if (slot->tgid != tgid || slot->object != object
+	    || slot->object_gen != gen || slot->type != type) {
+		if (slot->count)
+			WARN_ON(log_repeat(slot));
+
+		slot->tgid = tgid;
+		slot->object = object;
+		slot->object_gen = gen;
+		slot->type = type;
+		slot->gen++;
+		slot->cookie = (u32)slot->gen << 16
+			| (smp_processor_id() & 0xff) << DEDUP_SLOT_BITS | i;
+		slot->count = 0;
+		slot->stamp = jiffies;
+	} else if (!dedup_window || aggregate || log_dedup_expired(slot)) {
+		/* tables of the aggregation mode count duplicates themselves */
+		if (slot->count)
+			WARN_ON(log_repeat(slot));
+
+		slot->count = 0;
+		slot->stamp = jiffies;
+	} else {
+		slot->count++;
+		seen = true;
+	}
+	*cookie = slot->cookie;
+	put_cpu_var(dedup_cache);
+
+	return seen;
+}
+
+int __must_check log_socket(const struct sockaddr_storage *const saddr,
+			    const u32 cookie)
+{
+	struct commit_s commit = {
+		.size = offsetof(struct log_socket_entry, saddr)
+	};
+	struct log_socket_entry *entry;
+
+	switch (saddr->ss_family) {
+	case AF_INET:
+		commit.size += sizeof(entry->saddr.in);
+		break;
+	case AF_INET6:
+		commit.size += sizeof(entry->saddr.in6);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (filter_socket(saddr))
+		return 0;
+
+	if (aggregate)
+		return aggr_socket(saddr, commit.size
+				   - offsetof(typeof(*entry), saddr), cookie);
+
+	entry = log_reserve(&commit);
 	if (!entry)
 		return -EFAULT;
 
-	entry->log_type = LOG_SOCKET;
-	memcpy(&entry->socket.saddr, saddr, sizeof(entry->socket.saddr));
-	return log_common(entry, &commit);
+	entry->cookie = cookie;
+	memcpy(&entry->saddr, saddr, commit.size - offsetof(typeof(*entry), saddr));
+	return log_common(&entry->common, LOG_SOCKET, &commit);
 }
 
 int __must_check log_process(void)
 {
 	struct commit_s commit = { .size = sizeof(struct log_entry) };
-	struct log_entry *entry = ringbuf_reserve(&rbuf, &commit);
+	struct log_entry *entry;
+
+	if (filter_task() || reader_excluded())
+		return 0;
+
+	if (aggregate)
+		return aggr_process();
+
+	entry = log_reserve(&commit);
 	if (!entry)
 		return -EFAULT;
 
-	entry->log_type = LOG_PROCESS;
 	/* current no additional record info */
-	return log_common(entry, &commit);
+	return log_common(entry, LOG_PROCESS, &commit);
 }
 
-int __must_check log_file(const char *const filename)
+int __must_check log_file(const char *const filename, const u32 cookie)
 {
-	struct commit_s commit = { .size = sizeof(struct log_entry) };
-	struct log_entry *entry = ringbuf_reserve(&rbuf, &commit);
+	size_t len = strnlen(filename, PATH_MAX);
+	struct commit_s commit = {
+		.size = sizeof(struct log_file_entry) + len + 1
+	};
+	struct log_file_entry *entry;
+	int ret;
+
+	if (filter_file(filename, len))
+		return 0;
+
+	if (aggregate) {
+		ret = aggr_file(filename, len, cookie);
+		if (ret != -ENAMETOOLONG)
+			return ret;
+	}
+
+	entry = log_reserve(&commit);
 	if (!entry)
 		return -EFAULT;
 
-	entry->log_type = LOG_FILE;
-	strncpy(entry->file.filename, filename, PATH_MAX);
-	return log_common(entry, &commit);
+	entry->cookie = cookie;
+	memcpy(entry->filename, filename, len);
+	entry->filename[len] = '\0';
+	return log_common(&entry->common, LOG_FILE, &commit);
+}
+
+/* not filtered, the analysis needs every one of them */
+int __must_check log_sampling(const u8 hook, const u8 level,
+			      const u32 skipped, const u32 load)
+{
+	struct commit_s commit = { .size = sizeof(struct log_sampling_entry) };
+	struct log_sampling_entry *entry = log_reserve(&commit);
+	if (!entry)
+		return -EFAULT;
+
+	entry->hook = hook;
+	entry->level = level;
+	entry->skipped = skipped;
+	entry->load = load;
+	return log_common(&entry->common, LOG_SAMPLING, &commit);
+}
+
+/* not aggregated, every watched call is of interest */
+int __must_check log_watch(const char *const funcname)
+{
+	size_t len = strnlen(funcname, KSYM_NAME_LEN - 1);
+	struct commit_s commit = {
+		.size = sizeof(struct log_watch_entry) + len + 1
+	};
+	struct log_watch_entry *entry;
+
+	if (filter_task() || reader_excluded())
+		return 0;
+
+	entry = log_reserve(&commit);
+	if (!entry)
+		return -EFAULT;
+
+	memcpy(entry->funcname, funcname, len);
+	entry->funcname[len] = '\0';
+	return log_common(&entry->common, LOG_WATCH, &commit);
+}
+
+/*
+ * Unlike the others, called from process context and about any task.
+ * The record is made readable and readers are woken up at once.
+ */
+int __must_check log_hidden(const struct task_struct *const task,
+			    const u8 missing)
+{
+	struct commit_s commit = { .size = sizeof(struct log_hidden_entry) };
+	struct log_hidden_entry *entry;
+	ulong flags;
+
+	/* writers of a ring must not be preempted */
+	local_irq_save(flags);
+	entry = ringbuf_set_reserve(&rbuf, &commit);
+	if (!entry) {
+		local_irq_restore(flags);
+		return -EFAULT;
+	}
+
+	entry->missing = missing;
+	log_fill(&entry->common, LOG_HIDDEN, &commit, task);
+	ringbuf_set_commit(&rbuf, &commit);
+	ringbuf_flush(per_cpu_ptr(rbuf.rbs, commit.cpu));
+	local_irq_restore(flags);
+
+	atomic_set(&log_timed_out, 1);
+	wake_up_interruptible(&log_wait);
+	return 0;
 }
 
 
 int __must_check proc_init(void)
 {
-	ringbuf_init(&rbuf);
+	/* a block holds two records at least, so wraps don't lose all */
+	int ret = ringbuf_set_init(&rbuf, (ulong)ring_size << 10,
+				   max_t(ulong, (ulong)ring_block_size << 10,
+					 2 * LOG_ENTRY_MAX));
+	if (ret)
+		return ret;
+
+	printk("rkcd: %lu blocks of %lu KiB per cpu ring\n",
+	       ringbuf_num_blocks() - 1, ringbuf_block_size() >> 10);
+
+	log_batch = alloc_percpu(struct log_batch);
+	if (!log_batch) {
+		ringbuf_set_free(&rbuf);
+		return -ENOMEM;
+	}
+
+	init_irq_work(&log_wakeup_work, log_wakeup);
+
+	/* readers hide their process trees, see reader.c */
+	struct proc_dir_entry *de = proc_create(PROCNAME, 0400, NULL,
+						&proc_fops);
+	if (IS_ERR_OR_NULL(de))
+		goto err_rbuf;
+
+	de = proc_create(PROCNAME "_bin", 0400, NULL, &proc_bin_fops);
+	if (IS_ERR_OR_NULL(de))
+		goto err_proc;
 
-	struct proc_dir_entry *de = proc_create(PROCNAME, 0, NULL, &proc_fops);
-	if (IS_ERR(de))
-		return PTR_ERR(de);
+	de = proc_create(PROCNAME "_stats", 0, NULL, &stats_fops);
+	if (IS_ERR_OR_NULL(de))
+		goto err_proc_bin;
 
+	schedule_delayed_work(&log_timeout_work, msecs_to_jiffies(poll_timeout));
 	return 0;
+
+err_proc_bin:
+	remove_proc_entry(PROCNAME "_bin", NULL);
+err_proc:
+	remove_proc_entry(PROCNAME, NULL);
+err_rbuf:
+	free_percpu(log_batch);
+	ringbuf_set_free(&rbuf);
+	return de ? PTR_ERR(de) : -ENOMEM;
 }
 
 void proc_cleanup(void)
 {
+	remove_proc_entry(PROCNAME "_stats", NULL);
+	remove_proc_entry(PROCNAME "_bin", NULL);
 	remove_proc_entry(PROCNAME, NULL);
 
-	ringbuf_free(&rbuf);
+	cancel_delayed_work_sync(&log_timeout_work);
+	/* the hooks are cleared, the counts of the live slots are flushed */
+	on_each_cpu(log_dedup_sweep, (void *)1, 1);
+	irq_work_sync(&log_wakeup_work);
+
+	free_percpu(log_batch);
+	ringbuf_set_free(&rbuf);
 }
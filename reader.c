@@ -0,0 +1,246 @@
+/**
+ * @file reader.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief readers of the log and exclusion of their process trees
+ *
+ * A task opening a log interface is registered as a reader, its thread
+ * group and the groups it forks later are marked, and events of marked
+ * groups are not logged. Otherwise the tools a reader runs to check the
+ * log (ls, ps, netstat) would feed it back.
+ *
+ * Marks are kept in a small open addressed table of tgids, so the check
+ * on the hot path is a few loads. Groups forked by a marked one are
+ * marked by the wake_up_new_task hook, the marks of exited ones are
+ * reaped when their slots are needed. A mark also keeps the start time
+ * of the group leader, so a reused tgid never matches the mark of the
+ * exited group. All marks of a reader are dropped when it closes the
+ * last interface.
+ *
+ * Being a reader hides a process tree, so only CAP_SYS_ADMIN may be one.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/hash.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+
+#include "rootkiticide.h"
+
+#define READERS_MAX 16
+#define READER_MARKS 256	/* Must be a power of 2 */
+#define READER_PROBES 8		/* slots looked up before giving up */
+
+/* slot is being written, never equal to a tgid */
+#define READER_MARK_BUSY (-1)
+
+struct reader {
+	const struct file *file;	/* NULL - empty */
+	pid_t tgid;
+};
+
+struct reader_mark {
+	pid_t tgid;		/* 0 - empty */
+	pid_t root;		/* tgid of the reader it descends from */
+	u64 start_time;		/* of the group leader */
+};
+
+/* >0 - number of procfs readers, -1 - exclusive reader of the device */
+static atomic_t readers = ATOMIC_INIT(0);
+
+static struct reader reader_list[READERS_MAX];
+static DEFINE_MUTEX(reader_lock);
+
+/* a fork that does not fit is logged as usual and counted */
+static struct reader_mark reader_marks[READER_MARKS];
+static atomic_t reader_marks_dropped = ATOMIC_INIT(0);
+
+static u64 reader_start_time(const struct task_struct *const task)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,17,0)
+	return timespec_to_ns(&task->start_time);
+#else
+	return task->start_time;
+#endif
+}
+
+static struct reader_mark *reader_mark_slot(const pid_t tgid, const int i)
+{
+	return &reader_marks[(hash_32(tgid, ilog2(READER_MARKS)) + i)
+			     & (READER_MARKS - 1)];
+}
+
+static struct reader_mark *reader_mark_find(const pid_t tgid,
+					    const u64 start_time)
+{
+	struct reader_mark *mark;
+	int i;
+
+	for (i = 0; i < READER_PROBES; i++) {
+		mark = reader_mark_slot(tgid, i);
+		if (READ_ONCE(mark->tgid) != tgid)
+			continue;
+		smp_rmb();
+		if (READ_ONCE(mark->start_time) == start_time)
+			return mark;
+	}
+
+	return NULL;
+}
+
+/* forked groups are not referenced, so exited ones leave their marks */
+static bool reader_mark_stale(const struct reader_mark *mark, const pid_t tgid)
+{
+	const struct task_struct *task;
+	bool stale;
+
+	if (tgid <= 0 || tgid == mark->root)
+		return false;
+
+	rcu_read_lock();
+	task = pid_task(find_pid_ns(tgid, &init_pid_ns), PIDTYPE_PID);
+	stale = !task ||
+		reader_start_time(task) != READ_ONCE(mark->start_time);
+	rcu_read_unlock();
+
+	return stale;
+}
+
+/* called from any context */
+static void reader_mark(const pid_t tgid, const u64 start_time,
+			const pid_t root)
+{
+	struct reader_mark *mark;
+	pid_t old;
+	int i;
+
+	for (i = 0; i < READER_PROBES; i++) {
+		mark = reader_mark_slot(tgid, i);
+		old = READ_ONCE(mark->tgid);
+		if (old == tgid && READ_ONCE(mark->start_time) == start_time)
+			return;
+		if (old && !reader_mark_stale(mark, old))
+			continue;
+		if (cmpxchg(&mark->tgid, old, READER_MARK_BUSY) != old)
+			continue;
+
+		mark->root = root;
+		WRITE_ONCE(mark->start_time, start_time);
+		smp_wmb();
+		WRITE_ONCE(mark->tgid, tgid);
+		return;
+	}
+
+	atomic_inc(&reader_marks_dropped);
+}
+
+/**
+ * Check whether current task belongs to a reader tree.
+ *
+ * @return true if events of the task must not be logged.
+ */
+bool __must_check reader_excluded(void)
+{
+	if (!atomic_read(&readers))
+		return false;
+
+	return reader_mark_find(current->tgid,
+				reader_start_time(current->group_leader)) != NULL;
+}
+
+/*
+ * Called from the wake_up_new_task hook by the parent. The child of a
+ * new group is its leader.
+ */
+void reader_fork(const struct task_struct *const child)
+{
+	struct reader_mark *parent;
+
+	if (!atomic_read(&readers) || child->tgid == current->tgid)
+		return;
+
+	parent = reader_mark_find(current->tgid,
+				  reader_start_time(current->group_leader));
+	if (parent)
+		reader_mark(child->tgid, reader_start_time(child),
+			    READ_ONCE(parent->root));
+}
+
+int __must_check reader_acquire(const struct file *const file,
+				const bool exclusive)
+{
+	struct reader *free = NULL;
+	int i, ret;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	mutex_lock(&reader_lock);
+	for (i = 0; i < READERS_MAX && !free; i++)
+		if (!reader_list[i].file)
+			free = &reader_list[i];
+
+	if (!free) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (exclusive)
+		ret = atomic_cmpxchg(&readers, 0, -1) ? -EBUSY : 0;
+	else
+		ret = atomic_inc_unless_negative(&readers) ? 0 : -EBUSY;
+	if (ret)
+		goto out;
+
+	free->file = file;
+	free->tgid = current->tgid;
+	reader_mark(current->tgid, reader_start_time(current->group_leader),
+		    current->tgid);
+out:
+	mutex_unlock(&reader_lock);
+	return ret;
+}
+
+void reader_release(const struct file *const file, const bool exclusive)
+{
+	pid_t tgid = 0, marked;
+	int i;
+
+	mutex_lock(&reader_lock);
+	for (i = 0; i < READERS_MAX; i++) {
+		if (reader_list[i].file == file) {
+			tgid = reader_list[i].tgid;
+			reader_list[i].file = NULL;
+		}
+	}
+
+	/* the reader may still have another interface open */
+	for (i = 0; i < READERS_MAX; i++)
+		if (reader_list[i].file && reader_list[i].tgid == tgid)
+			tgid = 0;
+
+	for (i = 0; tgid && i < READER_MARKS; i++) {
+		marked = READ_ONCE(reader_marks[i].tgid);
+		if (marked > 0 && reader_marks[i].root == tgid)
+			cmpxchg(&reader_marks[i].tgid, marked, 0);
+	}
+
+	if (exclusive)
+		atomic_set(&readers, 0);
+	else
+		atomic_dec(&readers);
+	mutex_unlock(&reader_lock);
+}
+
+/* forks of readers that did not fit the marks and were logged */
+void reader_stats(struct seq_file *s)
+{
+	seq_printf(s, "reader\t%d\t%d\n", READER_MARKS,
+		   atomic_read(&reader_marks_dropped));
+}
@@ -8,90 +8,262 @@
 #include "ringbuf.h"
 #include "ringbuf_internal.h"
 
-void ringbuf_init(struct ringbuf * const rb)
+ulong rb_num_blocks __read_mostly;
+ulong rb_block_shift __read_mostly;
+
+/*
+ * Blocks are physically contiguous if there are free pages of the order,
+ * on a fragmented host they are virtually contiguous instead. The blocks
+ * are exposed through mmap, so they are zeroed.
+ */
+static int __must_check block_alloc(struct block * const block, const int node)
+{
+	block->pages = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO |
+					__GFP_NOWARN | __GFP_NORETRY,
+					rb_block_shift - PAGE_SHIFT);
+	if (block->pages) {
+		block->ptr = page_address(block->pages);
+		return 0;
+	}
+
+	block->ptr = vzalloc_node(RB_BLOCK_SIZE, node);
+	return block->ptr ? 0 : -ENOMEM;
+}
+
+static void block_free(struct block * const block)
+{
+	if (block->pages)
+		__free_pages(block->pages, rb_block_shift - PAGE_SHIFT);
+	else
+		vfree(block->ptr);
+}
+
+/* allocate the ring on the memory node of its cpu */
+int __must_check ringbuf_init(struct ringbuf * const rb, const int node)
 {
 	ulong i;
 
-	rb->blocks = kcalloc(sizeof(*rb->blocks), RB_NUM_BLOCKS + 1, GFP_KERNEL);
-	rb->block_map = kcalloc(sizeof(*rb->block_map), RB_NUM_BLOCKS, GFP_KERNEL);
+	rb->blocks = kzalloc_node(sizeof(*rb->blocks) * (RB_NUM_BLOCKS + 1),
+				  GFP_KERNEL, node);
+	rb->block_map = kzalloc_node(sizeof(*rb->block_map) * RB_NUM_BLOCKS,
+				     GFP_KERNEL, node);
+	if (!rb->blocks || !rb->block_map)
+		goto err;
+
 	for (i = 0; i < RB_NUM_BLOCKS + 1; i++) {
-		rb->blocks[i].pages = alloc_pages(GFP_KERNEL,
-						get_count_order(RB_BLOCK_PAGES));
+		if (block_alloc(&rb->blocks[i], node))
+			goto err;
 		atomic_set(&rb->blocks[i].occupied, 0);
-		rb->blocks[i].ptr = page_address(&rb->blocks[i].pages[0]);
+		/* the lap before the first one, so never taken for data */
+		atomic_set(&rb->blocks[i].base,
+			   (i - RB_NUM_BLOCKS) * RB_BLOCK_SIZE);
 	}
 
 	for (i = 0; i < RB_NUM_BLOCKS; i++) {
 		atomic_set(&rb->block_map[i], i);
 	}
 	atomic_set(&rb->read_map, RB_NUM_BLOCKS);
+
+	atomic_set(&rb->head, 0);
+	atomic_set(&rb->tail, 0);
+	atomic_set(&rb->overwritten, 0);
+	memset(&rb->stats, 0, sizeof(rb->stats));
+	return 0;
+
+err:
+	ringbuf_free(rb);
+	return -ENOMEM;
 }
 
+/* frees a partially allocated ring as well */
 void ringbuf_free(struct ringbuf * const rb)
 {
 	ulong i;
 
-	/* fixme: proper cleanup */
-
-	for (i = 0; i < RB_NUM_BLOCKS + 1; i++)
-		__free_pages(rb->blocks[i].pages, get_count_order(RB_BLOCK_PAGES));
+	for (i = 0; rb->blocks && i < RB_NUM_BLOCKS + 1; i++)
+		block_free(&rb->blocks[i]);
 	kfree(rb->block_map);
 	kfree(rb->blocks);
+	rb->block_map = NULL;
+	rb->blocks = NULL;
 }
 
 
-void *ringbuf_reserve(struct ringbuf * const rb, struct commit_s *commit)
+/* reserve bytes (headers included) within a block */
+static void *reserve_bytes(struct ringbuf * const rb, struct commit_s *commit,
+			   const size_t bytes)
 {
 	ulong offset;
 	ulong blocknum;
 	long overflow_bytes;
-	size_t size = commit->size;
-	struct entry_header *header;
 
 retry:
-	offset = atomic_add_return(size + RB_HEADER_SIZE, &rb->tail)
-			- size - RB_HEADER_SIZE;
+	offset = atomic_add_return(bytes, &rb->tail) - bytes;
 	blocknum = offset_to_blocknum(offset);
 
-	overflow_bytes = (offset_in_block(offset) + size + RB_HEADER_SIZE) - RB_BLOCK_SIZE;
+	overflow_bytes = (offset_in_block(offset) + bytes) - RB_BLOCK_SIZE;
 	if (unlikely(overflow_bytes > 0)) {
-		boundary_wrap(rb, blocknum, offset, size, overflow_bytes);
+		boundary_wrap(rb, blocknum, offset, bytes - RB_HEADER_SIZE,
+			      overflow_bytes);
+		atomic_inc(&rb->stats.wraps);
 		goto retry;
 	}
 
-	header = block_acquire(rb, blocknum)->ptr + offset_in_block(offset);
+	atomic64_add(bytes, &rb->stats.bytes);
+
+	commit->blocknum = blocknum;
+	commit->offset = offset;
+	return block_acquire(rb, blocknum)->ptr + offset_in_block(offset);
+}
+
+static void *put_entry(struct entry_header * const header, const size_t size)
+{
 	header->skip_header = false;
 	header->short_header = false;
 	header->long_size = size;
-
-	commit->blocknum = blocknum;
 	return (void *)header + RB_HEADER_SIZE;
 }
 
+void *ringbuf_reserve(struct ringbuf * const rb, struct commit_s *commit)
+{
+	struct entry_header *header;
+
+	header = reserve_bytes(rb, commit, commit->size + RB_HEADER_SIZE);
+	atomic64_inc(&rb->stats.reserved);
+	return put_entry(header, commit->size);
+}
+
 void ringbuf_commit(struct ringbuf * const rb, const struct commit_s *commit)
 {
 	struct block *block = block_acquire(rb, commit->blocknum);
-	finalize_commit(rb, block, commit->blocknum, commit->size + RB_HEADER_SIZE);
+	finalize_commit(rb, block, commit->blocknum, commit->offset,
+			commit->size + RB_HEADER_SIZE);
 }
 
+/* room taken by an entry in a batch */
+size_t ringbuf_batch_size(const size_t size)
+{
+	return size + RB_HEADER_SIZE;
+}
+
+/* bigger batches would waste too much of a block on wraps */
+size_t ringbuf_batch_max(void)
+{
+	return RB_BLOCK_SIZE / 4;
+}
+
+/**
+ * Reserve room for several entries with a single tail update, the
+ * entries are put with ringbuf_batch_entry and committed all at once.
+ *
+ * @param bytes sum of ringbuf_batch_size of the entries,
+ * at most ringbuf_batch_max
+ */
+void ringbuf_reserve_batch(struct ringbuf * const rb,
+			   struct ringbuf_batch * const batch,
+			   const size_t bytes)
+{
+	batch->commit.size = bytes;
+	batch->pos = reserve_bytes(rb, &batch->commit, bytes);
+	batch->entries = 0;
+}
+
+void *ringbuf_batch_entry(struct ringbuf_batch * const batch, const size_t size)
+{
+	void *entry = put_entry(batch->pos, size);
+
+	batch->pos = entry + size;
+	batch->entries++;
+	return entry;
+}
+
+void ringbuf_commit_batch(struct ringbuf * const rb,
+			  const struct ringbuf_batch * const batch)
+{
+	const struct commit_s *commit = &batch->commit;
+	struct block *block = block_acquire(rb, commit->blocknum);
+
+	atomic64_add(batch->entries, &rb->stats.reserved);
+	finalize_commit(rb, block, commit->blocknum, commit->offset,
+			commit->size);
+}
+
+/*
+ * Pad the partially written block with a skip entry, so it becomes
+ * readable after the commits in flight. Costs the rest of the block.
+ */
+void ringbuf_flush(struct ringbuf * const rb)
+{
+	ulong offset, blocknum;
+	long overflow_bytes;
+	size_t skip = RB_BLOCK_SIZE - offset_in_block(atomic_read(&rb->tail));
+	struct block *block;
+
+	if (skip == RB_BLOCK_SIZE)
+		return;
+
+	offset = atomic_add_return(skip, &rb->tail) - skip;
+	blocknum = offset_to_blocknum(offset);
+
+	overflow_bytes = (offset_in_block(offset) + skip) - RB_BLOCK_SIZE;
+	if (unlikely(overflow_bytes > 0)) {
+		/* raced with a writer, so pad the both blocks */
+		boundary_wrap(rb, blocknum, offset, skip - RB_HEADER_SIZE,
+			      overflow_bytes);
+		return;
+	}
+
+	block = block_acquire(rb, blocknum);
+	write_skip_header(block->ptr + offset_in_block(offset), skip, skip);
+	finalize_commit(rb, block, blocknum, offset, skip);
+}
+
+/**
+ * Swap the block at head with the read block.
+ *
+ * @return -EBUSY if writers are in the block at head, -EAGAIN if the
+ * block was lapped and dropped, the reader retries both later.
+ */
 static int __must_check switch_readblock(struct ringbuf * const rb)
 {
 	ulong blocknum, switchwith_id, readblock_id;
+	struct block *readblock;
+	int lag;
 
 	blocknum = offset_to_blocknum(atomic_read(&rb->head));
 	readblock_id = atomic_read(&rb->read_map) & RB_BLOCKID_MASK;
 	switchwith_id = atomic_read(&rb->block_map[blocknum]) & RB_BLOCKID_MASK;
 	/* check if used by the writer and switch atomically */
 	if (atomic_cmpxchg(&rb->block_map[blocknum], switchwith_id, readblock_id)
-			!= switchwith_id)
-		return 1; // fixme: proper error
+			!= switchwith_id) {
+		atomic_inc(&rb->stats.switch_failed);
+		return -EBUSY;
+	}
 	atomic_set(&rb->read_map, switchwith_id);
+
+	readblock = readblock_get(rb);
+	if (!atomic_read(&readblock->occupied))
+		return 0;
+
+	/*
+	 * Writers may have lapped the block between reading head and
+	 * the switch. Newer data moves head to it (the skipped blocks are
+	 * lost), older data was already passed by head and is dropped.
+	 */
+	lag = atomic_read(&readblock->base) - atomic_read(&rb->head);
+	if (lag > 0) {
+		atomic_add(lag, &rb->head);
+		atomic_add(lag / RB_BLOCK_SIZE, &rb->overwritten);
+	} else if (lag < 0) {
+		atomic_set(&readblock->occupied, 0);
+		return -EAGAIN;
+	}
+
 	return 0;
 }
 
-void * __must_check ringbuf_read(struct ringbuf * const rb)
+void * __must_check ringbuf_peek(struct ringbuf * const rb)
 {
-	void *addr;
 	struct entry_header *header;
 	size_t size;
 	ulong occupied;
@@ -102,26 +274,509 @@ entry:
 		if (switch_readblock(rb))
 			return NULL;
 		readblock = readblock_get(rb);
-		occupied = atomic_read(&readblock->occupied);
+		/* block at head was never written */
+		if (!(occupied = atomic_read(&readblock->occupied)))
+			return NULL;
 	}
 
-	header = addr = readblock->ptr + RB_BLOCK_SIZE - occupied;
+	header = readblock->ptr + RB_BLOCK_SIZE - occupied;
 
 	if (unlikely(header->skip_header)) {
-		if (header->short_header) {
-			size = header->short_size;
-			atomic_add(size + 1, &rb->head);
-			atomic_sub(size + 1, &readblock->occupied);
-		} else {
-			size = header->long_size;
-			atomic_add(size + RB_HEADER_SIZE, &rb->head);
-			atomic_sub(size + RB_HEADER_SIZE, &readblock->occupied);
-		}
+		size = entry_size(header);
+		atomic_add(size, &rb->head);
+		atomic_sub(size, &readblock->occupied);
 		goto entry;
 	}
 
-	size = header->long_size;
-	atomic_add(size + RB_HEADER_SIZE, &rb->head);
-	atomic_sub(size + RB_HEADER_SIZE, &readblock->occupied);
-	return addr + RB_HEADER_SIZE;
+	return (void *)header + RB_HEADER_SIZE;
+}
+
+/* drop the entry returned by ringbuf_peek */
+void ringbuf_consume(struct ringbuf * const rb)
+{
+	struct block *readblock = readblock_get(rb);
+	struct entry_header *header = readblock->ptr + RB_BLOCK_SIZE
+		- atomic_read(&readblock->occupied);
+	size_t size = entry_size(header);
+
+	atomic_add(size, &rb->head);
+	atomic_sub(size, &readblock->occupied);
+}
+
+void * __must_check ringbuf_read(struct ringbuf * const rb)
+{
+	void *addr = ringbuf_peek(rb);
+	if (addr)
+		ringbuf_consume(rb);
+	return addr;
+}
+
+/* bytes written but not read yet */
+ulong ringbuf_fill(struct ringbuf * const rb)
+{
+	ulong fill = (u32)(atomic_read(&rb->tail) - atomic_read(&rb->head));
+	return min(fill, ringbuf_size());
+}
+
+/* bytes reserved since the start, wraps at 4GiB */
+u32 ringbuf_written(struct ringbuf * const rb)
+{
+	return atomic_read(&rb->tail);
+}
+
+ulong ringbuf_size(void)
+{
+	return RB_NUM_BLOCKS * RB_BLOCK_SIZE;
+}
+
+/*
+ * Cursor readers read the blocks in place, so an entry is valid only
+ * if its block is completed in the lap of the cursor (base matches)
+ * and was not reserved for the next lap yet (tail has not passed it
+ * by the ring size). Writers move tail before writing, so checking it
+ * after a copy tells whether the copy is intact, like a seqcount.
+ */
+static bool cursor_overrun(struct ringbuf * const rb, const u32 pos)
+{
+	u32 start = pos & ~(RB_BLOCK_SIZE - 1);
+
+	smp_rmb();
+	return (u32)(atomic_read(&rb->tail) - start) > ringbuf_size();
+}
+
+/* skip to the oldest block writers can't reach before the next lap */
+static void cursor_resync(struct ringbuf * const rb,
+			  struct ringbuf_cursor * const cur)
+{
+	u32 oldest = (atomic_read(&rb->tail) & ~(RB_BLOCK_SIZE - 1))
+		- (RB_NUM_BLOCKS - 1) * RB_BLOCK_SIZE;
+
+	cur->lost += (u32)(oldest - cur->pos);
+	cur->pos = oldest;
+}
+
+/* start at the oldest entry still in the ring */
+void ringbuf_cursor_init(struct ringbuf * const rb,
+			 struct ringbuf_cursor * const cur)
+{
+	cur->pos = 0;
+	if ((u32)atomic_read(&rb->tail) > (RB_NUM_BLOCKS - 1) * RB_BLOCK_SIZE)
+		cursor_resync(rb, cur);
+	/* nothing was there to read */
+	cur->lost = 0;
+}
+
+/**
+ * Entry at the cursor, it may be overwritten at any moment, so copy
+ * it and check the copy with ringbuf_cursor_consume.
+ *
+ * @param size of the entry, within the block even if overwritten
+ * @return NULL if there are no completed entries after the cursor
+ */
+void * __must_check ringbuf_cursor_peek(struct ringbuf * const rb,
+					struct ringbuf_cursor * const cur,
+					size_t *const size)
+{
+	struct entry_header header;
+	struct block *block;
+	ulong offset, len;
+
+	for (;;) {
+		if (cursor_overrun(rb, cur->pos)) {
+			cursor_resync(rb, cur);
+			continue;
+		}
+
+		if (cur->pos == (u32)atomic_read(&rb->tail))
+			return NULL;
+
+		block = block_at(rb, cur->pos);
+		if ((u32)atomic_read(&block->base)
+		    != (cur->pos & ~(RB_BLOCK_SIZE - 1)))
+			return NULL;	/* writers are still in the block */
+		smp_rmb();
+
+		/* a short header is the last byte of the block */
+		offset = offset_in_block(cur->pos);
+		memset(&header, 0, sizeof(header));
+		memcpy(&header, block->ptr + offset,
+		       min((ulong)RB_HEADER_SIZE, RB_BLOCK_SIZE - offset));
+		len = entry_size(&header);
+
+		if (cursor_overrun(rb, cur->pos))
+			continue;
+
+		if (!len || offset + len > RB_BLOCK_SIZE) {
+			/* can't be, but don't get stuck */
+			cur->lost += RB_BLOCK_SIZE - offset;
+			cur->pos += RB_BLOCK_SIZE - offset;
+			continue;
+		}
+
+		if (header.skip_header) {
+			cur->pos += len;
+			continue;
+		}
+
+		cur->next = cur->pos + len;
+		*size = len - RB_HEADER_SIZE;
+		return block->ptr + offset + RB_HEADER_SIZE;
+	}
+}
+
+/**
+ * Move the cursor past the peeked entry.
+ *
+ * @return false if the entry was overwritten while it was copied
+ */
+bool __must_check ringbuf_cursor_consume(struct ringbuf * const rb,
+					 struct ringbuf_cursor * const cur)
+{
+	/* the next peek skips the overwritten entries */
+	if (cursor_overrun(rb, cur->pos))
+		return false;
+
+	cur->pos = cur->next;
+	return true;
+}
+
+/* bytes written but not read by the cursor yet */
+ulong ringbuf_cursor_lag(struct ringbuf * const rb,
+			 const struct ringbuf_cursor * const cur)
+{
+	ulong lag = (u32)(atomic_read(&rb->tail) - READ_ONCE(cur->pos));
+	return min(lag, ringbuf_size());
+}
+
+/**
+ * Drop the rest of the read block and swap in the next full one,
+ * which is then read in place by the caller.
+ *
+ * @return offset of the first entry in the read block or -EAGAIN
+ */
+long __must_check ringbuf_next_readblock(struct ringbuf * const rb)
+{
+	struct block *readblock = readblock_get(rb);
+	ulong occupied = atomic_read(&readblock->occupied);
+
+	atomic_add(occupied, &rb->head);
+	atomic_sub(occupied, &readblock->occupied);
+
+	if (switch_readblock(rb))
+		return -EAGAIN;
+
+	occupied = atomic_read(&readblock_get(rb)->occupied);
+	if (!occupied)
+		return -EAGAIN;
+
+	return RB_BLOCK_SIZE - occupied;
+}
+
+/* index of the read block within the mapping of the ring */
+ulong ringbuf_readblock(struct ringbuf * const rb)
+{
+	return atomic_read(&rb->read_map) & RB_BLOCKID_MASK;
+}
+
+/* map all blocks of the ring (the read one included) starting at addr */
+int __must_check ringbuf_mmap(struct ringbuf * const rb,
+			      struct vm_area_struct *vma, const ulong addr)
+{
+	struct block *block;
+	ulong i, off;
+	int ret;
+
+	for (i = 0; i < RB_NUM_BLOCKS + 1; i++) {
+		block = &rb->blocks[i];
+		if (block->pages) {
+			ret = remap_pfn_range(vma, addr + i * RB_BLOCK_SIZE,
+					      page_to_pfn(block->pages),
+					      RB_BLOCK_SIZE, vma->vm_page_prot);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		/* vmalloc'ed block, mapped page by page */
+		for (off = 0; off < RB_BLOCK_SIZE; off += PAGE_SIZE) {
+			ret = remap_pfn_range(vma, addr + i * RB_BLOCK_SIZE + off,
+					      vmalloc_to_pfn(block->ptr + off),
+					      PAGE_SIZE, vma->vm_page_prot);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+ulong ringbuf_block_size(void)
+{
+	return RB_BLOCK_SIZE;
+}
+
+ulong ringbuf_num_blocks(void)
+{
+	return RB_NUM_BLOCKS + 1;
+}
+
+/**
+ * Set the geometry of the rings. The block size is rounded up and the
+ * number of blocks down to powers of 2, rings of more than
+ * RB_NUM_BLOCKS_MAX blocks get bigger blocks instead.
+ *
+ * @param size bytes of a ring (of a cpu)
+ * @param block_size minimal size of a block, entries must fit in it
+ */
+static int __must_check ringbuf_geometry(const ulong size,
+					 const ulong block_size)
+{
+	ulong shift = order_base_2(max_t(ulong, block_size, PAGE_SIZE));
+
+	if (size > RB_SIZE_MAX || (size >> shift) < 2)
+		return -EINVAL;
+
+	while ((size >> shift) > RB_NUM_BLOCKS_MAX)
+		shift++;
+
+	rb_block_shift = shift;
+	rb_num_blocks = rounddown_pow_of_two(size >> shift);
+	return 0;
+}
+
+/**
+ * Allocate a ring per possible cpu, each on the node of its cpu.
+ * See ringbuf_geometry for the sizes.
+ */
+int __must_check ringbuf_set_init(struct ringbuf_set * const set,
+				  const ulong size, const ulong block_size)
+{
+	int cpu, ret;
+
+	ret = ringbuf_geometry(size, block_size);
+	if (ret)
+		return ret;
+
+	set->rbs = alloc_percpu(struct ringbuf);
+	if (!set->rbs)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		ret = ringbuf_init(per_cpu_ptr(set->rbs, cpu), cpu_to_node(cpu));
+		if (ret) {
+			ringbuf_set_free(set);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+void ringbuf_set_free(struct ringbuf_set * const set)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		ringbuf_free(per_cpu_ptr(set->rbs, cpu));
+
+	free_percpu(set->rbs);
+	set->rbs = NULL;
+}
+
+/* reserve in the ring of the current cpu, so writers don't share tail */
+void *ringbuf_set_reserve(struct ringbuf_set * const set,
+			  struct commit_s *commit)
+{
+	commit->cpu = raw_smp_processor_id();
+	return ringbuf_reserve(per_cpu_ptr(set->rbs, commit->cpu), commit);
+}
+
+void ringbuf_set_commit(struct ringbuf_set * const set,
+			const struct commit_s *commit)
+{
+	ringbuf_commit(per_cpu_ptr(set->rbs, commit->cpu), commit);
+}
+
+void ringbuf_set_reserve_batch(struct ringbuf_set * const set,
+			       struct ringbuf_batch * const batch,
+			       const size_t bytes)
+{
+	batch->commit.cpu = raw_smp_processor_id();
+	ringbuf_reserve_batch(per_cpu_ptr(set->rbs, batch->commit.cpu),
+			      batch, bytes);
+}
+
+void ringbuf_set_commit_batch(struct ringbuf_set * const set,
+			      const struct ringbuf_batch * const batch)
+{
+	ringbuf_commit_batch(per_cpu_ptr(set->rbs, batch->commit.cpu), batch);
+}
+
+/**
+ * Merge rings of the set: find the oldest entry among heads of all rings.
+ * Entries become readable per full block, so order between cpus
+ * is exact only within the blocks already completed.
+ *
+ * @param cpu ring of the entry, pass it to ringbuf_consume
+ */
+void * __must_check ringbuf_set_peek(struct ringbuf_set * const set,
+				     int *const cpu)
+{
+	void *oldest = NULL, *addr;
+	int i;
+
+	for_each_possible_cpu(i) {
+		addr = ringbuf_peek(per_cpu_ptr(set->rbs, i));
+		if (addr && (!oldest || set->before(addr, oldest))) {
+			oldest = addr;
+			*cpu = i;
+		}
+	}
+
+	return oldest;
+}
+
+void ringbuf_set_cursor_free(struct ringbuf_set_cursor *sc)
+{
+	if (!sc)
+		return;
+
+	kfree(sc->cursors);
+	kfree(sc->heap);
+	kfree(sc->queued);
+	kfree(sc);
+}
+
+/* cursors of all rings of the set, free with ringbuf_set_cursor_free */
+struct ringbuf_set_cursor * __must_check ringbuf_set_cursor_alloc(
+	struct ringbuf_set * const set)
+{
+	struct ringbuf_set_cursor *sc;
+	int cpu;
+
+	sc = kzalloc(sizeof(*sc), GFP_KERNEL);
+	if (!sc)
+		return NULL;
+
+	sc->cursors = kcalloc(nr_cpu_ids, sizeof(*sc->cursors), GFP_KERNEL);
+	sc->heap = kcalloc(nr_cpu_ids, sizeof(*sc->heap), GFP_KERNEL);
+	sc->queued = kcalloc(nr_cpu_ids, sizeof(*sc->queued), GFP_KERNEL);
+	if (!sc->cursors || !sc->heap || !sc->queued) {
+		ringbuf_set_cursor_free(sc);
+		return NULL;
+	}
+
+	for_each_possible_cpu(cpu)
+		ringbuf_cursor_init(per_cpu_ptr(set->rbs, cpu),
+				    &sc->cursors[cpu]);
+
+	return sc;
+}
+
+/* an entry being overwritten only misorders itself */
+static bool set_head_before(struct ringbuf_set * const set,
+			    const struct ringbuf_set_head *a,
+			    const struct ringbuf_set_head *b)
+{
+	return set->before(a->entry, b->entry);
+}
+
+static void set_heap_down(struct ringbuf_set * const set,
+			  struct ringbuf_set_cursor *const sc, int i)
+{
+	struct ringbuf_set_head *heap = sc->heap, tmp;
+	int child;
+
+	while ((child = 2 * i + 1) < sc->nr_heads) {
+		if (child + 1 < sc->nr_heads
+		    && set_head_before(set, &heap[child + 1], &heap[child]))
+			child++;
+		if (!set_head_before(set, &heap[child], &heap[i]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void set_heap_up(struct ringbuf_set * const set,
+			struct ringbuf_set_cursor *const sc, int i)
+{
+	struct ringbuf_set_head *heap = sc->heap, tmp;
+	int parent;
+
+	while (i && set_head_before(set, &heap[i],
+				    &heap[parent = (i - 1) / 2])) {
+		tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+/* peek the rings without an entry in the heap */
+static void set_heap_rescan(struct ringbuf_set * const set,
+			    struct ringbuf_set_cursor *const sc)
+{
+	struct ringbuf_set_head *head;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (sc->queued[cpu])
+			continue;
+
+		head = &sc->heap[sc->nr_heads];
+		head->entry = ringbuf_cursor_peek(per_cpu_ptr(set->rbs, cpu),
+						  &sc->cursors[cpu],
+						  &head->size);
+		if (!head->entry)
+			continue;
+
+		head->cpu = cpu;
+		sc->queued[cpu] = true;
+		set_heap_up(set, sc, sc->nr_heads++);
+	}
+
+	sc->until_rescan = nr_cpu_ids;
+}
+
+/* like ringbuf_set_peek, but for the cursors of a reader */
+void * __must_check ringbuf_set_cursor_peek(struct ringbuf_set * const set,
+					    struct ringbuf_set_cursor *const sc,
+					    int *const cpu, size_t *const size)
+{
+	if (!sc->nr_heads || !sc->until_rescan)
+		set_heap_rescan(set, sc);
+
+	if (!sc->nr_heads)
+		return NULL;
+
+	*cpu = sc->heap[0].cpu;
+	*size = sc->heap[0].size;
+	return sc->heap[0].entry;
+}
+
+/* move past the last peeked entry, cpu is the one it returned */
+bool __must_check ringbuf_set_cursor_consume(struct ringbuf_set * const set,
+					     struct ringbuf_set_cursor *const sc,
+					     const int cpu)
+{
+	struct ringbuf_set_head *top = &sc->heap[0];
+	bool ret = ringbuf_cursor_consume(per_cpu_ptr(set->rbs, cpu),
+					  &sc->cursors[cpu]);
+
+	if (sc->until_rescan)
+		sc->until_rescan--;
+
+	/* the entry after it or the same one after an overrun */
+	top->entry = ringbuf_cursor_peek(per_cpu_ptr(set->rbs, cpu),
+					 &sc->cursors[cpu], &top->size);
+	if (!top->entry) {
+		sc->queued[cpu] = false;
+		*top = sc->heap[--sc->nr_heads];
+	}
+	set_heap_down(set, sc, 0);
+
+	return ret;
 }
@@ -7,14 +7,33 @@
 
 #pragma once
 
+#ifdef __KERNEL__
 #include <linux/atomic.h>
 #include <linux/slab.h>
 #include <linux/highmem.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/topology.h>
+#else
+#include "ringbuf_user.h"
+#endif
+
+/* counters of a ring, see /proc/rootkiticide_stats */
+struct ringbuf_stats {
+	atomic64_t reserved;	/* entries reserved */
+	atomic64_t bytes;	/* bytes reserved, headers included */
+	atomic_t wraps;		/* reservations retried at a block boundary */
+	atomic_t spins;		/* failed cmpxchg in block_acquire */
+	atomic_t switch_failed;	/* read block switches refused by a writer */
+};
 
 struct block {
 	void *ptr;		/* virtual memory address */
 	atomic_t occupied;	/* bytes committed */
-	struct page *pages;	/* underlying pages */
+	atomic_t base;		/* ring offset of the data, set once full */
+	struct page *pages;	/* underlying pages, NULL if vmalloc'ed */
 };
 
 struct ringbuf {
@@ -37,16 +56,126 @@ struct ringbuf {
 	atomic_t head; /* next byte to read */
 	atomic_t tail; /* next byte to write */
 
+	atomic_t overwritten; /* blocks dropped before being read */
+
+	struct ringbuf_stats stats;
+
 	struct block *blocks; /* array of storage blocks */
 };
 
+/* per-CPU ring buffers read as a single one */
+struct ringbuf_set {
+	struct ringbuf __percpu *rbs;
+
+	/* orders records of different CPUs for the reader */
+	bool (*before)(const void *a, const void *b);
+};
+
+/*
+ * Position of a reader that does not consume, so any number of readers
+ * read the ring independently. Writers never wait for them, entries
+ * overwritten before being read are skipped and counted.
+ */
+struct ringbuf_cursor {
+	u32 pos;		/* ring offset of the next entry */
+	u32 next;		/* of the entry after the peeked one */
+	ulong lost;		/* bytes overwritten before being read */
+};
+
+/* peeked entry of a ring, see struct ringbuf_set_cursor */
+struct ringbuf_set_head {
+	void *entry;
+	size_t size;
+	int cpu;
+};
+
+/*
+ * Cursors of a reader of the whole set. Peeked entries of the rings are
+ * kept in a min-heap, so a record costs a peek of its own ring and
+ * O(log(nr_cpus)) comparisons. Rings without entries are peeked again
+ * when the heap runs empty or after nr_cpu_ids records.
+ */
+struct ringbuf_set_cursor {
+	struct ringbuf_cursor *cursors;	/* per cpu */
+	struct ringbuf_set_head *heap;	/* oldest first */
+	int nr_heads;
+	bool *queued;			/* per cpu, the ring is in the heap */
+	ulong until_rescan;		/* records before idle rings are peeked */
+};
+
 struct commit_s {
 	ulong blocknum;
+	ulong offset;		/* ring offset of the entry */
 	size_t size;
+	int cpu;		/* ring of the set, filled by ringbuf_set_reserve */
 };
 
-void ringbuf_init(struct ringbuf * const rb);
+/* entries reserved and committed together, see ringbuf_reserve_batch */
+struct ringbuf_batch {
+	struct commit_s commit;	/* size is of the whole batch */
+	void *pos;		/* where the next entry goes */
+	ulong entries;
+};
+
+int __must_check ringbuf_init(struct ringbuf * const rb, const int node);
 void ringbuf_free(struct ringbuf * const rb);
 void *ringbuf_reserve(struct ringbuf * const rb, struct commit_s *commit);
 void ringbuf_commit(struct ringbuf * const rb, const struct commit_s *commit);
+void * __must_check ringbuf_peek(struct ringbuf * const rb);
+void ringbuf_consume(struct ringbuf * const rb);
 void * __must_check ringbuf_read(struct ringbuf * const rb);
+void ringbuf_flush(struct ringbuf * const rb);
+ulong ringbuf_fill(struct ringbuf * const rb);
+u32 ringbuf_written(struct ringbuf * const rb);
+ulong ringbuf_size(void);
+
+size_t ringbuf_batch_size(const size_t size);
+size_t ringbuf_batch_max(void);
+void ringbuf_reserve_batch(struct ringbuf * const rb,
+			   struct ringbuf_batch * const batch,
+			   const size_t bytes);
+void *ringbuf_batch_entry(struct ringbuf_batch * const batch, const size_t size);
+void ringbuf_commit_batch(struct ringbuf * const rb,
+			  const struct ringbuf_batch * const batch);
+
+void ringbuf_cursor_init(struct ringbuf * const rb,
+			 struct ringbuf_cursor * const cur);
+void * __must_check ringbuf_cursor_peek(struct ringbuf * const rb,
+					struct ringbuf_cursor * const cur,
+					size_t *const size);
+bool __must_check ringbuf_cursor_consume(struct ringbuf * const rb,
+					 struct ringbuf_cursor * const cur);
+ulong ringbuf_cursor_lag(struct ringbuf * const rb,
+			 const struct ringbuf_cursor * const cur);
+
+/* in-place reading of whole blocks through mmap */
+long __must_check ringbuf_next_readblock(struct ringbuf * const rb);
+ulong ringbuf_readblock(struct ringbuf * const rb);
+int __must_check ringbuf_mmap(struct ringbuf * const rb,
+			      struct vm_area_struct *vma, const ulong addr);
+ulong ringbuf_block_size(void);
+ulong ringbuf_num_blocks(void);
+
+int __must_check ringbuf_set_init(struct ringbuf_set * const set,
+				  const ulong size, const ulong block_size);
+void ringbuf_set_free(struct ringbuf_set * const set);
+void *ringbuf_set_reserve(struct ringbuf_set * const set,
+			  struct commit_s *commit);
+void ringbuf_set_commit(struct ringbuf_set * const set,
+			const struct commit_s *commit);
+void ringbuf_set_reserve_batch(struct ringbuf_set * const set,
+			       struct ringbuf_batch * const batch,
+			       const size_t bytes);
+void ringbuf_set_commit_batch(struct ringbuf_set * const set,
+			      const struct ringbuf_batch * const batch);
+void * __must_check ringbuf_set_peek(struct ringbuf_set * const set,
+				     int *const cpu);
+struct ringbuf_set_cursor * __must_check ringbuf_set_cursor_alloc(
+	struct ringbuf_set * const set);
+void ringbuf_set_cursor_free(struct ringbuf_set_cursor *sc);
+void * __must_check ringbuf_set_cursor_peek(struct ringbuf_set * const set,
+					    struct ringbuf_set_cursor *const sc,
+					    int *const cpu, size_t *const size);
+bool __must_check ringbuf_set_cursor_consume(struct ringbuf_set * const set,
+					     struct ringbuf_set_cursor *const sc,
+					     const int cpu);
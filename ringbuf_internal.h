@@ -8,9 +8,15 @@
 #include "ringbuf.h"
 
 
-#define RB_NUM_BLOCKS 16	/* Must be a power of 2 */
-#define RB_BLOCK_PAGES 32	/* Must be a power of 2 */
-#define RB_BLOCK_SIZE (RB_BLOCK_PAGES << PAGE_SHIFT)
+/* geometry shared by all rings, set once by ringbuf_set_init */
+extern ulong rb_num_blocks;	/* a power of 2 */
+extern ulong rb_block_shift;	/* log2 of the block size */
+
+#define RB_NUM_BLOCKS rb_num_blocks
+#define RB_BLOCK_SIZE (1UL << rb_block_shift)
+
+#define RB_NUM_BLOCKS_MAX 1024	/* bigger rings get bigger blocks */
+#define RB_SIZE_MAX (1UL << 30)	/* offsets are u32 and wrap at 4GiB */
 
 #define RB_HEADER_SIZE sizeof(struct entry_header)
 
@@ -38,7 +44,15 @@ struct block *readblock_get(struct ringbuf * const rb)
 static inline
 ulong offset_to_blocknum(const ulong offset)
 {
-	return (offset >> get_count_order(RB_BLOCK_SIZE)) % RB_NUM_BLOCKS;
+	return (offset >> rb_block_shift) & (RB_NUM_BLOCKS - 1);
+}
+
+/* block at the offset, not acquired */
+static inline
+struct block *block_at(struct ringbuf * const rb, const ulong offset)
+{
+	ulong blockmap = atomic_read(&rb->block_map[offset_to_blocknum(offset)]);
+	return &rb->blocks[blockmap & RB_BLOCKID_MASK];
 }
 
 static inline
@@ -46,12 +60,21 @@ struct block *block_acquire(struct ringbuf * const rb, const ulong blocknum)
 {
 	ulong blockmap;
 
-	/* try to set the reserved bit */
-	do {
-		// max 2/3 times ?
+	/*
+	 * Try to set the reserved bit. The cmpxchg only fails if the map
+	 * changed under us: the reader swapped the block (it can't again
+	 * while the bit is set) or another writer released it, so every
+	 * retry is progress of someone else. There is no way out for the
+	 * caller, its entry is already reserved in the block, so the loop
+	 * is not cut, the retries are counted in stats.spins instead.
+	 */
+	for (;;) {
 		blockmap = atomic_read(&rb->block_map[blocknum]);
-	} while (atomic_cmpxchg(&rb->block_map[blocknum], blockmap,
-				blockmap | RB_BLOCKRESERVE_BIT) != blockmap);
+		if (atomic_cmpxchg(&rb->block_map[blocknum], blockmap,
+				   blockmap | RB_BLOCKRESERVE_BIT) == blockmap)
+			break;
+		atomic_inc(&rb->stats.spins);
+	}
 	return &rb->blocks[blockmap & RB_BLOCKID_MASK];
 }
 
@@ -76,6 +99,16 @@ ulong offset_in_block(const ulong offset)
 	return offset & (RB_BLOCK_SIZE - 1);
 }
 
+/* size of the entry including its header */
+static inline
+size_t entry_size(const struct entry_header * const header)
+{
+	if (header->skip_header && header->short_header)
+		return header->short_size + 1;
+
+	return header->long_size + RB_HEADER_SIZE;
+}
+
 static inline
 void write_skip_header(void *addr, size_t skip, size_t b_avail)
 {
@@ -93,25 +126,30 @@ void write_skip_header(void *addr, size_t skip, size_t b_avail)
 static inline
 void check_overwrite(struct ringbuf * const rb, struct block * const block)
 {
-	ulong old_head;
-
 	/*
 	 * Overwrite block if fully written
-	 * push reader by block (only once if there are concurrent writes)
+	 * push reader by block (only once if there are concurrent writes).
+	 * The push must not be lost when racing with the reader advancing
+	 * head, otherwise the reader swaps in the newest block next and then
+	 * goes back to the older ones.
 	 */
 	if (atomic_cmpxchg(&block->occupied, RB_BLOCK_SIZE, 0) == RB_BLOCK_SIZE) {
-		old_head = atomic_read(&rb->head);
-		atomic_cmpxchg(&rb->head, old_head, old_head + RB_BLOCK_SIZE);
+		atomic_add(RB_BLOCK_SIZE, &rb->head);
+		atomic_inc(&rb->overwritten);
 	}
 }
 
 static inline
 void finalize_commit(struct ringbuf * const rb, struct block * const block,
-		const ulong blocknum, const ulong bytes)
+		const ulong blocknum, const ulong offset, const ulong bytes)
 {
 	check_overwrite(rb, block);
-	if (atomic_add_return(bytes, &block->occupied) == RB_BLOCK_SIZE)
+	if (atomic_add_return(bytes, &block->occupied) == RB_BLOCK_SIZE) {
+		/* lets the reader tell the lap of the block */
+		atomic_set(&block->base, offset & ~(RB_BLOCK_SIZE - 1));
+		smp_wmb();
 		block_release(rb, blocknum);
+	}
 }
 
 static inline
@@ -123,10 +161,11 @@ void boundary_wrap(struct ringbuf * const rb, const ulong blocknum,
 	ulong prev_bytes = size + RB_HEADER_SIZE - overflow_bytes;
 
 	write_skip_header(addr, prev_bytes, prev_bytes);
-	finalize_commit(rb, block, blocknum, prev_bytes);
+	finalize_commit(rb, block, blocknum, offset, prev_bytes);
 
-	block = block_acquire(rb, (blocknum + 1) % RB_NUM_BLOCKS);
+	block = block_acquire(rb, (blocknum + 1) & (RB_NUM_BLOCKS - 1));
 	addr = block->ptr;
 	write_skip_header(addr, overflow_bytes, overflow_bytes);
-	finalize_commit(rb, block, (blocknum + 1) % RB_NUM_BLOCKS, overflow_bytes);
+	finalize_commit(rb, block, (blocknum + 1) & (RB_NUM_BLOCKS - 1),
+			offset + prev_bytes, overflow_bytes);
 }
@@ -0,0 +1,397 @@
+/**
+ * @file ringbuf_test.c
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief userspace stress test and benchmark of the ringbuffer
+ *
+ * Writer threads reserve/commit records of random size, one by one or
+ * in batches, while a reader consumes them concurrently. Every record
+ * is checked for integrity and per-writer ordering (records may be
+ * lost on overwrite, but never corrupted, duplicated or reordered).
+ * Runs with a ring shared by all writers, with a ring per writer, with
+ * a ring per writer read by several cursor readers at once, and with
+ * small vmalloc'ed rings read by cursors, and reports throughput.
+ *
+ * Writers of a shared ring must not be descheduled within a record
+ * (in the kernel they run with preemption disabled), otherwise other
+ * writers may lap them. So the shared ring is tested with no more
+ * threads than online cpus.
+ *
+ * Usage: ringbuf-test [ops per thread] [max threads]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ringbuf.h"
+
+int nr_cpu_ids;
+__thread int ringbuf_this_cpu;
+bool ringbuf_fragmented;
+
+#define RECORD_MIN 32
+#define RECORD_MAX 2048
+#define CURSOR_READERS 3
+#define BATCH_RECORDS 8
+
+#define RING_SIZE (512 << 10)
+#define BLOCK_SIZE (32 << 10)
+/* blocks that are not contiguous, laps are frequent */
+#define SMALL_RING_SIZE (64 << 10)
+#define SMALL_BLOCK_SIZE (8 << 10)
+
+struct record {
+	u32 writer;
+	u32 seq;
+	u32 size;
+	u32 sum;
+	u64 stamp;
+	u8 payload[];
+} __attribute__((packed));	/* entries are not aligned */
+
+struct test {
+	struct ringbuf_set set;
+	bool shared;		/* all writers use ring 0 */
+	int readers;		/* cursor readers, 0 - a consuming reader */
+	int threads;
+	ulong ops;
+
+	pthread_barrier_t start;
+	atomic_int writing;
+	atomic_bool flushed;	/* the rest is readable */
+
+	/* reader results */
+	atomic_ulong read;
+	atomic_bool failed;
+};
+
+static u64 now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u8 pattern(const struct record *r, const size_t i)
+{
+	return r->seq * 31 + r->writer + i;
+}
+
+static u32 checksum(const struct record *r)
+{
+	u32 sum = r->writer ^ r->seq ^ r->size;
+	size_t i;
+
+	for (i = 0; i < r->size - sizeof(*r); i++)
+		sum = sum * 33 + r->payload[i];
+	return sum;
+}
+
+static bool record_before(const void *a, const void *b)
+{
+	return ((const struct record *)a)->stamp
+		< ((const struct record *)b)->stamp;
+}
+
+struct writer_arg {
+	struct test *test;
+	u32 id;
+};
+
+static void fill(struct record *r, const u32 writer, const u32 seq,
+		 const size_t size)
+{
+	size_t i;
+
+	r->writer = writer;
+	r->seq = seq;
+	r->size = size;
+	r->stamp = now();
+	for (i = 0; i < size - sizeof(*r); i++)
+		r->payload[i] = pattern(r, i);
+	r->sum = checksum(r);
+}
+
+/* a few small records reserved at once, like an fd table snapshot */
+static u32 write_batch(struct test *test, const u32 writer, u32 seq, u32 rnd)
+{
+	struct ringbuf_batch batch;
+	size_t sizes[BATCH_RECORDS], bytes = 0;
+	int i;
+
+	for (i = 0; i < BATCH_RECORDS; i++) {
+		sizes[i] = RECORD_MIN + (rnd >> i * 4) % 256;
+		bytes += ringbuf_batch_size(sizes[i]);
+	}
+
+	ringbuf_set_reserve_batch(&test->set, &batch, bytes);
+	for (i = 0; i < BATCH_RECORDS; i++)
+		fill(ringbuf_batch_entry(&batch, sizes[i]), writer, seq++,
+		     sizes[i]);
+	ringbuf_set_commit_batch(&test->set, &batch);
+
+	return seq;
+}
+
+static void *writer(void *arg)
+{
+	struct writer_arg *w = arg;
+	struct test *test = w->test;
+	struct commit_s commit;
+	u32 rnd = w->id * 2654435761U + 1;
+	u32 seq = 0;
+
+	ringbuf_this_cpu = test->shared ? 0 : w->id;
+	pthread_barrier_wait(&test->start);
+
+	while (seq < test->ops) {
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+
+		if (rnd % 8 == 0 && test->ops - seq >= BATCH_RECORDS) {
+			seq = write_batch(test, w->id, seq, rnd);
+			continue;
+		}
+
+		commit.size = RECORD_MIN + rnd % (RECORD_MAX - RECORD_MIN);
+		fill(ringbuf_set_reserve(&test->set, &commit), w->id, seq++,
+		     commit.size);
+		ringbuf_set_commit(&test->set, &commit);
+	}
+
+	atomic_fetch_sub(&test->writing, 1);
+	return NULL;
+}
+
+static bool check(struct test *test, const struct record *r, long *last_seq)
+{
+	size_t i;
+
+	if (r->size < RECORD_MIN || r->size >= RECORD_MAX) {
+		fprintf(stderr, "invalid size %u\n", r->size);
+		return false;
+	}
+
+	if (r->writer >= (u32)test->threads) {
+		fprintf(stderr, "invalid writer %u\n", r->writer);
+		return false;
+	}
+
+	if (r->sum != checksum(r)) {
+		fprintf(stderr, "corrupted record %u/%u\n", r->writer, r->seq);
+		return false;
+	}
+
+	for (i = 0; i < r->size - sizeof(*r); i++) {
+		if (r->payload[i] != pattern(r, i)) {
+			fprintf(stderr, "corrupted payload %u/%u\n",
+				r->writer, r->seq);
+			return false;
+		}
+	}
+
+	if ((long)r->seq <= last_seq[r->writer]) {
+		fprintf(stderr, "writer %u: seq %u after %ld\n",
+			r->writer, r->seq, last_seq[r->writer]);
+		return false;
+	}
+	last_seq[r->writer] = r->seq;
+
+	return true;
+}
+
+static void *reader(void *arg)
+{
+	struct test *test = arg;
+	long last_seq[test->threads];
+	struct record *r;
+	bool flushed = false;
+	int i, cpu;
+
+	for (i = 0; i < test->threads; i++)
+		last_seq[i] = -1;
+
+	pthread_barrier_wait(&test->start);
+
+	for (;;) {
+		r = ringbuf_set_peek(&test->set, &cpu);
+		if (!r) {
+			if (flushed)
+				break;
+			/* partial blocks are readable only after a flush */
+			if (!atomic_load(&test->writing)) {
+				for_each_possible_cpu(i)
+					ringbuf_flush(per_cpu_ptr(test->set.rbs, i));
+				flushed = true;
+			}
+			continue;
+		}
+
+		if (!check(test, r, last_seq)) {
+			test->failed = true;
+			break;
+		}
+
+		ringbuf_consume(per_cpu_ptr(test->set.rbs, cpu));
+		test->read++;
+	}
+
+	return NULL;
+}
+
+/* reads along with the other cursor readers, checks only intact copies */
+static void *cursor_reader(void *arg)
+{
+	struct test *test = arg;
+	long last_seq[test->threads];
+	struct ringbuf_set_cursor *cursor;
+	u8 copy[RECORD_MAX];
+	struct record *r;
+	ulong read = 0;
+	bool flushed;
+	size_t size;
+	int i, cpu;
+
+	for (i = 0; i < test->threads; i++)
+		last_seq[i] = -1;
+
+	cursor = ringbuf_set_cursor_alloc(&test->set);
+	pthread_barrier_wait(&test->start);
+
+	for (;;) {
+		flushed = atomic_load(&test->flushed);
+		r = ringbuf_set_cursor_peek(&test->set, cursor, &cpu, &size);
+		if (!r) {
+			if (flushed)
+				break;
+			continue;
+		}
+
+		memcpy(copy, r, min(size, sizeof(copy)));
+		if (!ringbuf_set_cursor_consume(&test->set, cursor, cpu))
+			continue;
+
+		if (size != ((struct record *)copy)->size ||
+		    !check(test, (struct record *)copy, last_seq)) {
+			test->failed = true;
+			break;
+		}
+		read++;
+	}
+
+	test->read += read;
+	ringbuf_set_cursor_free(cursor);
+	return NULL;
+}
+
+static bool run(const bool shared, const int readers, const int threads,
+		const ulong ops)
+{
+	struct test test = {
+		.set = { .before = record_before },
+		.shared = shared,
+		.readers = readers,
+		.threads = threads,
+		.ops = ops,
+	};
+	struct writer_arg args[threads];
+	pthread_t writers[threads], rd[readers ?: 1];
+	ulong overwritten = 0, reserved = 0, spins = 0;
+	struct ringbuf *rb;
+	u64 start;
+	double secs;
+	int i;
+
+	nr_cpu_ids = shared ? 1 : threads;
+	if (ringbuf_fragmented ?
+	    ringbuf_set_init(&test.set, SMALL_RING_SIZE, SMALL_BLOCK_SIZE) :
+	    ringbuf_set_init(&test.set, RING_SIZE, BLOCK_SIZE)) {
+		fprintf(stderr, "ringbuf_set_init failed\n");
+		return false;
+	}
+
+	atomic_init(&test.writing, threads);
+	pthread_barrier_init(&test.start, NULL, threads + (readers ?: 1) + 1);
+
+	if (readers) {
+		for (i = 0; i < readers; i++)
+			pthread_create(&rd[i], NULL, cursor_reader, &test);
+	} else {
+		pthread_create(&rd[0], NULL, reader, &test);
+	}
+	for (i = 0; i < threads; i++) {
+		args[i] = (struct writer_arg){ .test = &test, .id = i };
+		pthread_create(&writers[i], NULL, writer, &args[i]);
+	}
+
+	pthread_barrier_wait(&test.start);
+	start = now();
+	for (i = 0; i < threads; i++)
+		pthread_join(writers[i], NULL);
+	secs = (now() - start) / 1e9;
+
+	if (readers) {
+		/* partial blocks are readable only after a flush */
+		for_each_possible_cpu(i)
+			ringbuf_flush(per_cpu_ptr(test.set.rbs, i));
+		atomic_store(&test.flushed, true);
+		for (i = 0; i < readers; i++)
+			pthread_join(rd[i], NULL);
+		/* per reader */
+		test.read /= readers;
+	} else {
+		pthread_join(rd[0], NULL);
+	}
+
+	for_each_possible_cpu(i) {
+		rb = per_cpu_ptr(test.set.rbs, i);
+		overwritten += atomic_read(&rb->overwritten);
+		reserved += atomic64_read(&rb->stats.reserved);
+		spins += atomic_read(&rb->stats.spins);
+	}
+
+	/* the flush is not an entry */
+	if (reserved != threads * ops) {
+		fprintf(stderr, "reserved %lu of %lu\n", reserved, threads * ops);
+		test.failed = true;
+	}
+
+	printf("%-7s %7d %12.0f %8.1f %10lu %10lu %11lu %8lu%s\n",
+	       shared ? "shared" : ringbuf_fragmented ? "vmalloc" :
+	       readers ? "cursor" : "percpu", threads,
+	       threads * ops / secs, secs * 1e9 * threads / (threads * ops),
+	       (ulong)test.read, threads * ops - test.read, overwritten, spins,
+	       test.failed ? "  FAILED" : "");
+
+	pthread_barrier_destroy(&test.start);
+	ringbuf_set_free(&test.set);
+	return !test.failed;
+}
+
+int main(int argc, char *argv[])
+{
+	ulong ops = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+	int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_threads = argc > 2 ? atoi(argv[2]) : cpus;
+	bool ok = true;
+	int threads;
+
+	printf("%-7s %7s %12s %8s %10s %10s %11s %8s\n", "mode", "threads",
+	       "ops/s", "ns/op", "read", "lost", "overwritten", "spins");
+
+	for (threads = 1; threads <= max_threads; threads *= 2) {
+		if (threads <= cpus)
+			ok &= run(true, 0, threads, ops);
+		ok &= run(false, 0, threads, ops);
+		ok &= run(false, CURSOR_READERS, threads, ops);
+		ringbuf_fragmented = true;
+		ok &= run(false, CURSOR_READERS, threads, ops);
+		ringbuf_fragmented = false;
+	}
+
+	return ok ? 0 : 1;
+}
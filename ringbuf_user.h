@@ -0,0 +1,225 @@
+/**
+ * @file ringbuf_user.h
+ * @author Mikhail Klementyev <jollheef@riseup.net>
+ * @date October 2026
+ * @brief shim to build the ringbuffer as a userspace library
+ *
+ * Maps kernel primitives used by ringbuf.c to C11 atomics and malloc,
+ * so the same source is tested and benchmarked in userspace
+ * (see ringbuf_test.c). The user of the library defines nr_cpu_ids
+ * and ringbuf_fragmented, and sets ringbuf_this_cpu for each thread.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef unsigned long ulong;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define __must_check __attribute__((warn_unused_result))
+#define __percpu
+#define __read_mostly
+
+#define min(x, y) ((x) < (y) ? (x) : (y))
+#define max_t(type, x, y) ((type)(x) > (type)(y) ? (type)(x) : (type)(y))
+#define READ_ONCE(x) (*(const volatile typeof(x) *)&(x))
+
+/* atomic_t */
+
+typedef struct {
+	atomic_int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+static inline int atomic_read(const atomic_t *v)
+{
+	return atomic_load((atomic_int *)&v->counter);
+}
+
+static inline void atomic_set(atomic_t *v, int i)
+{
+	atomic_store(&v->counter, i);
+}
+
+static inline int atomic_add_return(int i, atomic_t *v)
+{
+	return atomic_fetch_add(&v->counter, i) + i;
+}
+
+static inline void atomic_add(int i, atomic_t *v)
+{
+	atomic_fetch_add(&v->counter, i);
+}
+
+static inline void atomic_sub(int i, atomic_t *v)
+{
+	atomic_fetch_sub(&v->counter, i);
+}
+
+static inline void atomic_inc(atomic_t *v)
+{
+	atomic_fetch_add(&v->counter, 1);
+}
+
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new)
+{
+	atomic_compare_exchange_strong(&v->counter, &old, new);
+	return old;
+}
+
+#define smp_wmb() atomic_thread_fence(memory_order_release)
+#define smp_rmb() atomic_thread_fence(memory_order_acquire)
+
+typedef struct {
+	atomic_llong counter;
+} atomic64_t;
+
+static inline long long atomic64_read(const atomic64_t *v)
+{
+	return atomic_load((atomic_llong *)&v->counter);
+}
+
+static inline void atomic64_add(long long i, atomic64_t *v)
+{
+	atomic_fetch_add(&v->counter, i);
+}
+
+static inline void atomic64_inc(atomic64_t *v)
+{
+	atomic_fetch_add(&v->counter, 1);
+}
+
+/* pages, a page is represented by its memory */
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+
+#define GFP_KERNEL 0
+#define __GFP_ZERO 1
+#define __GFP_NOWARN 0
+#define __GFP_NORETRY 0
+
+/* set by the user to test rings without contiguous blocks */
+extern bool ringbuf_fragmented;
+
+struct page {
+	u8 data[PAGE_SIZE];
+};
+
+static inline struct page *alloc_pages_node(int node, int gfp, unsigned order)
+{
+	struct page *page;
+
+	if (ringbuf_fragmented && order)
+		return NULL;
+
+	page = aligned_alloc(PAGE_SIZE, PAGE_SIZE << order);
+	if (page && (gfp & __GFP_ZERO))
+		memset(page, 0, PAGE_SIZE << order);
+	return page;
+}
+
+static inline void __free_pages(struct page *page, unsigned order)
+{
+	free(page);
+}
+
+static inline void *page_address(struct page *page)
+{
+	return page;
+}
+
+static inline ulong page_to_pfn(struct page *page)
+{
+	return (ulong)page >> PAGE_SHIFT;
+}
+
+static inline void *kcalloc(size_t n, size_t size, int gfp)
+{
+	return calloc(n, size);
+}
+
+static inline void *kzalloc(size_t size, int gfp)
+{
+	return calloc(1, size);
+}
+
+static inline void *kzalloc_node(size_t size, int gfp, int node)
+{
+	return calloc(1, size);
+}
+
+/* virtually contiguous memory */
+
+static inline void *vzalloc_node(ulong size, int node)
+{
+	return calloc(1, size);
+}
+
+static inline void vfree(const void *addr)
+{
+	free((void *)addr);
+}
+
+static inline ulong vmalloc_to_pfn(const void *addr)
+{
+	return (ulong)addr >> PAGE_SHIFT;
+}
+
+static inline void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+static inline ulong ilog2(ulong n)
+{
+	return 63 - __builtin_clzl(n);
+}
+
+static inline ulong rounddown_pow_of_two(ulong n)
+{
+	return 1UL << ilog2(n);
+}
+
+static inline ulong order_base_2(ulong n)
+{
+	return n > 1 ? ilog2(n - 1) + 1 : 0;
+}
+
+/* mmap is not available, but must compile */
+
+struct vm_area_struct {
+	ulong vm_page_prot;
+};
+
+static inline int remap_pfn_range(struct vm_area_struct *vma, ulong addr,
+				  ulong pfn, ulong size, ulong prot)
+{
+	return -ENOSYS;
+}
+
+/* per-cpu data, a "cpu" is a thread that set ringbuf_this_cpu */
+
+extern int nr_cpu_ids;
+extern __thread int ringbuf_this_cpu;
+
+#define alloc_percpu(type) ((type *)calloc(nr_cpu_ids, sizeof(type)))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) (&(ptr)[cpu])
+#define for_each_possible_cpu(cpu) \
+	for ((cpu) = 0; (cpu) < nr_cpu_ids; (cpu)++)
+#define raw_smp_processor_id() (ringbuf_this_cpu)
+#define cpu_to_node(cpu) 0
@@ -9,174 +9,1036 @@ package main
 
 import (
 	"bufio"
+	"bytes"
+	"container/list"
+	"encoding/binary"
 	"encoding/json"
+	"errors"
+	"flag"
 	"fmt"
 	"io"
+	"net"
 	"os"
-	"os/exec"
 	"path/filepath"
+	"sort"
+	"strconv"
 	"strings"
+	"syscall"
+	"time"
 )
 
-func readBytesUntilEOF(pipe io.ReadCloser) (buf []byte, err error) {
+type logEntry struct {
+	Seq        uint32
+	TS         uint64 // kernel local_clock(), ns
+	CPU        int
+	Type       string
+	PID        int
+	TGID       int
+	Comm       string
+	Cookie     uint32
+	Filename   string
+	Saddr      string
+	Count      uint32
+	RepeatTGID int    `json:"repeat_tgid"`
+	RepeatType string `json:"repeat_type"`
+	Hits       uint32
+	First      uint64
+	Last       uint64
+	Missing    uint8
+	Hook       string
+	Level      uint8
+	Skipped    uint32
+	Load       uint32
+}
+
+// Record types and sizes, see log_entry.h
+const (
+	logSocket = iota
+	logFile
+	logProcess
+	logRepeat
+	logSeen
+	logHidden
+	logSampling
+	logWatch
+)
+
+var logTypeNames = []string{"socket", "file", "process", "repeat", "seen",
+	"hidden", "sampling", "watch"}
+
+// Hooks of the sampling records, see latency_hook_names in latency.c
+var hookNames = []string{"try_to_wake_up", "wake_up_new_task",
+	"__vfs_write", "vfs_writev", "watch"}
+
+const (
+	logEntrySize         = 44
+	logRepeatEntrySize   = logEntrySize + 13
+	logSeenEntrySize     = logEntrySize + 20
+	logHiddenEntrySize   = logEntrySize + 1
+	logSamplingEntrySize = logEntrySize + 10
+)
+
+// Views a hidden task is missing from, see log_entry.h
+const (
+	hiddenPIDLookup = 1 << iota
+	hiddenTaskList
+)
+
+func missingViews(missing uint8) string {
+	views := []string{}
+	if missing&hiddenPIDLookup != 0 {
+		views = append(views, "pid lookup")
+	}
+	if missing&hiddenTaskList != 0 {
+		views = append(views, "task list")
+	}
+	return strings.Join(views, ", ")
+}
+
+var errShortRecord = errors.New("short record")
+
+func cString(buf []byte) string {
+	if n := bytes.IndexByte(buf, 0); n >= 0 {
+		buf = buf[:n]
+	}
+	return string(buf)
+}
+
+// formatAddr formats address the same way as the kernel %pISpc does
+func formatAddr(ip net.IP, port uint16) string {
+	if len(ip) == net.IPv4len {
+		return fmt.Sprintf("%s:%d", ip, port)
+	}
 
-	bufSize := 1024
+	host := ip.String()
+	if ip.To4() != nil {
+		host = "::ffff:" + host
+	}
+	return fmt.Sprintf("[%s]:%d", host, port)
+}
 
-	for err != io.EOF {
-		stdout := make([]byte, bufSize)
-		var n int
+// decodeSockaddr decodes sockaddr_in/sockaddr_in6
+func decodeSockaddr(buf []byte) (saddr string, err error) {
+	if len(buf) < 8 {
+		err = errShortRecord
+		return
+	}
 
-		n, err = pipe.Read(stdout)
-		if err != nil && err != io.EOF {
+	family := binary.LittleEndian.Uint16(buf)
+	port := binary.BigEndian.Uint16(buf[2:])
+	switch family {
+	case syscall.AF_INET:
+		saddr = formatAddr(net.IP(buf[4:8]), port)
+	case syscall.AF_INET6:
+		if len(buf) < 24 {
+			err = errShortRecord
 			return
 		}
+		saddr = formatAddr(net.IP(buf[8:24]), port)
+	default:
+		err = fmt.Errorf("unknown address family %d", family)
+	}
+	return
+}
 
-		buf = append(buf, stdout[:n]...)
+// decodeEntry decodes a binary record laid out as in log_entry.h
+func decodeEntry(buf []byte) (entry logEntry, err error) {
+	le := binary.LittleEndian
+
+	if len(buf) < logEntrySize {
+		err = errShortRecord
+		return
 	}
 
-	if err == io.EOF {
-		err = nil
+	size := int(le.Uint16(buf))
+	if size < logEntrySize || size > len(buf) {
+		err = fmt.Errorf("invalid record size %d", size)
+		return
 	}
 
+	t := int(buf[2])
+	if t >= len(logTypeNames) {
+		err = fmt.Errorf("unknown record type %d", t)
+		return
+	}
+
+	entry.Type = logTypeNames[t]
+	entry.Seq = le.Uint32(buf[4:])
+	entry.TS = le.Uint64(buf[8:])
+	entry.CPU = int(le.Uint32(buf[16:]))
+	entry.PID = int(int32(le.Uint32(buf[20:])))
+	entry.TGID = int(int32(le.Uint32(buf[24:])))
+	entry.Comm = cString(buf[28:logEntrySize])
+
+	payload := buf[logEntrySize:size]
+	switch t {
+	case logSocket, logFile:
+		if len(payload) < 4 {
+			err = errShortRecord
+			return
+		}
+		entry.Cookie = le.Uint32(payload)
+		if t == logSocket {
+			entry.Saddr, err = decodeSockaddr(payload[4:])
+		} else {
+			entry.Filename = cString(payload[4:])
+		}
+	case logRepeat:
+		if size < logRepeatEntrySize {
+			err = errShortRecord
+			return
+		}
+		entry.Cookie = le.Uint32(payload)
+		entry.Count = le.Uint32(payload[4:])
+		entry.RepeatTGID = int(int32(le.Uint32(payload[8:])))
+		if int(payload[12]) < len(logTypeNames) {
+			entry.RepeatType = logTypeNames[payload[12]]
+		}
+	case logSeen:
+		if size < logSeenEntrySize {
+			err = errShortRecord
+			return
+		}
+		entry.Hits = le.Uint32(payload)
+		entry.First = le.Uint64(payload[4:])
+		entry.Last = le.Uint64(payload[12:])
+	case logHidden:
+		if size < logHiddenEntrySize {
+			err = errShortRecord
+			return
+		}
+		entry.Missing = payload[0]
+	case logSampling:
+		if size < logSamplingEntrySize {
+			err = errShortRecord
+			return
+		}
+		if int(payload[0]) < len(hookNames) {
+			entry.Hook = hookNames[payload[0]]
+		}
+		entry.Level = payload[1]
+		entry.Skipped = le.Uint32(payload[2:])
+		entry.Load = le.Uint32(payload[6:])
+	case logWatch:
+		// the watched function
+		entry.Hook = cString(payload)
+	}
 	return
 }
 
-func readUntilEOF(pipe io.ReadCloser) (str string, err error) {
-	buf, err := readBytesUntilEOF(pipe)
-	str = string(buf)
+func readJSON(path string, handle func(logEntry)) (err error) {
+	file, err := os.Open(path)
+	if err != nil {
+		return
+	}
+	defer file.Close()
+
+	reader := bufio.NewReader(file)
+
+	for {
+		var line []byte
+		line, err = reader.ReadBytes('\n')
+		if err != nil {
+			break
+		}
+		var entry logEntry
+		json.Unmarshal(line, &entry)
+		handle(entry)
+	}
+
+	if err == io.EOF {
+		err = nil
+	}
 	return
 }
 
-func system(name string, arg ...string) (stdout string, stderr string,
-	ret int, err error) {
+// Binary stream, see log_stream_header in log_entry.h
+const (
+	logStreamMagic      = 0x62636b72
+	logStreamVersion    = 6
+	logStreamHeaderSize = 8
+)
 
-	cmd := exec.Command(name, arg...)
+// decodeStream decodes the binary stream header and the records after it
+func decodeStream(reader io.Reader, handle func(logEntry)) (err error) {
+	le := binary.LittleEndian
 
-	outPipe, err := cmd.StdoutPipe()
+	buf := make([]byte, 1<<16)
+	_, err = io.ReadFull(reader, buf[:logStreamHeaderSize])
 	if err != nil {
 		return
 	}
 
-	errPipe, err := cmd.StderrPipe()
+	magic, version := le.Uint32(buf), le.Uint16(buf[4:])
+	if magic != logStreamMagic || version != logStreamVersion {
+		return fmt.Errorf("unsupported stream version %d", version)
+	}
+
+	for {
+		_, err = io.ReadFull(reader, buf[:2])
+		if err == io.EOF {
+			return nil
+		} else if err != nil {
+			return
+		}
+
+		size := int(le.Uint16(buf))
+		if size < logEntrySize {
+			return fmt.Errorf("invalid record size %d", size)
+		}
+
+		_, err = io.ReadFull(reader, buf[2:size])
+		if err != nil {
+			return
+		}
+
+		var entry logEntry
+		entry, err = decodeEntry(buf[:size])
+		if err != nil {
+			return
+		}
+		handle(entry)
+	}
+}
+
+// decodeRecords decodes whole records returned by one read of the stream
+func decodeRecords(buf []byte, handle func(logEntry)) (err error) {
+	for len(buf) > 0 {
+		if len(buf) < 2 {
+			return errShortRecord
+		}
+
+		size := int(binary.LittleEndian.Uint16(buf))
+		if size < logEntrySize || size > len(buf) {
+			return fmt.Errorf("invalid record size %d", size)
+		}
+
+		var entry logEntry
+		entry, err = decodeEntry(buf[:size])
+		if err != nil {
+			return
+		}
+		handle(entry)
+
+		buf = buf[size:]
+	}
+	return
+}
+
+func readBinary(path string, handle func(logEntry)) (err error) {
+	file, err := os.Open(path)
 	if err != nil {
 		return
 	}
+	defer file.Close()
+
+	// kernel copies as many records as fit, so read with large chunks
+	return decodeStream(bufio.NewReaderSize(file, 1<<20), handle)
+}
+
+// Device control area, see dev.h
+const (
+	rkcdCtlMagic   = 0x64636b72
+	rkcdCtlVersion = 4
+	rkcdIocNext    = 0x7201 // _IO('r', 1)
+
+	rkcdCtlSize    = 24
+	rkcdCtlCPUSize = 24
+)
+
+// parseBlock walks ring buffer entries (see ringbuf_internal.h) of
+// a block starting at offset
+func parseBlock(block []byte, offset int, handle func(logEntry)) (err error) {
+	for offset < len(block) {
+		h := block[offset]
+		skip := h&1 != 0
+		short := h&2 != 0
+		if skip && short {
+			offset += int(h>>2) + 1
+			continue
+		}
+
+		if offset+5 > len(block) {
+			return errShortRecord
+		}
+		size := int(binary.LittleEndian.Uint32(block[offset+1:]))
+		offset += 5
+		if offset+size > len(block) {
+			return errShortRecord
+		}
 
-	cmd.Start()
+		if !skip {
+			var entry logEntry
+			entry, err = decodeEntry(block[offset : offset+size])
+			if err != nil {
+				return
+			}
+			handle(entry)
+		}
+		offset += size
+	}
+	return
+}
 
-	stdout, err = readUntilEOF(outPipe)
+// readMmap consumes all full blocks of the ring buffers in place
+func readMmap(path string, handle func(logEntry)) (err error) {
+	file, err := os.Open(path)
 	if err != nil {
 		return
 	}
+	defer file.Close()
+	fd := int(file.Fd())
 
-	stderr, err = readUntilEOF(errPipe)
+	le := binary.LittleEndian
+
+	ctl, err := syscall.Mmap(fd, 0, os.Getpagesize(), syscall.PROT_READ,
+		syscall.MAP_SHARED)
 	if err != nil {
 		return
 	}
+	magic, version := le.Uint32(ctl), le.Uint16(ctl[4:])
+	nrCPUs := int(le.Uint16(ctl[6:]))
+	numBlocks := int(le.Uint32(ctl[8:]))
+	blockSize := int(le.Uint32(ctl[12:]))
+	ctlSize := int(le.Uint32(ctl[16:]))
+	syscall.Munmap(ctl)
+
+	if magic != rkcdCtlMagic || version != rkcdCtlVersion {
+		return fmt.Errorf("unsupported device version %d", version)
+	}
 
-	err = cmd.Wait()
+	mem, err := syscall.Mmap(fd, 0, ctlSize+nrCPUs*numBlocks*blockSize,
+		syscall.PROT_READ, syscall.MAP_SHARED)
 	if err != nil {
-		fmt.Sscanf(err.Error(), "exit status %d", &ret)
 		return
 	}
+	defer syscall.Munmap(mem)
+
+	for progress := true; progress; {
+		progress = false
+		for cpu := 0; cpu < nrCPUs; cpu++ {
+			_, _, errno := syscall.Syscall(syscall.SYS_IOCTL,
+				uintptr(fd), rkcdIocNext, uintptr(cpu))
+			if errno == syscall.EAGAIN || errno == syscall.EINVAL {
+				continue
+			} else if errno != 0 {
+				return errno
+			}
+
+			c := mem[rkcdCtlSize+cpu*rkcdCtlCPUSize:]
+			readBlock := int(le.Uint32(c[12:]))
+			readOffset := int(le.Uint32(c[16:]))
 
+			base := ctlSize + (cpu*numBlocks+readBlock)*blockSize
+			err = parseBlock(mem[base:base+blockSize], readOffset,
+				handle)
+			if err != nil {
+				return
+			}
+			progress = true
+		}
+	}
 	return
 }
 
-type logEntry struct {
-	ID       int
-	PID      int
-	TGID     int
-	Comm     string
-	Filename string
-	Saddr    string
+// snapshot is the system view of one check phase, read directly from
+// /proc and directories (getdents) instead of forking ls/netstat/ps
+type snapshot struct {
+	pids  map[int]bool
+	addrs map[string]bool
+	dirs  map[string]map[string]bool // loaded on demand
 }
 
-func hiddenFile(filename string) (hidden bool) {
-	stdout, _, _, err := system("/bin/ls", "-a", filepath.Dir(filename))
+func readNames(dir string) (names []string, err error) {
+	file, err := os.Open(dir)
 	if err != nil {
-		panic(err)
+		return
+	}
+	defer file.Close()
+
+	return file.Readdirnames(-1)
+}
+
+// snapshotPIDs collects the visible processes and their threads
+func snapshotPIDs() (pids map[int]bool, err error) {
+	names, err := readNames("/proc")
+	if err != nil {
+		return
 	}
 
-	hidden = !strings.Contains(stdout, filepath.Base(filename))
+	pids = map[int]bool{}
+	for _, name := range names {
+		tgid, err := strconv.Atoi(name)
+		if err != nil {
+			continue
+		}
+		pids[tgid] = true
+
+		tasks, _ := readNames("/proc/" + name + "/task")
+		for _, task := range tasks {
+			if pid, err := strconv.Atoi(task); err == nil {
+				pids[pid] = true
+			}
+		}
+	}
 	return
 }
 
-func hiddenAddr(addr string) (hidden bool) {
-	stdout, _, _, err := system("/bin/netstat", "-n")
+// parseProcNetAddr parses "0100007F:0050" of /proc/net/{tcp,udp}{,6},
+// address is printed by 32-bit words in host order
+func parseProcNetAddr(field string) (addr string, err error) {
+	parts := strings.Split(field, ":")
+	if len(parts) != 2 || len(parts[0])%8 != 0 {
+		err = fmt.Errorf("invalid address %s", field)
+		return
+	}
+
+	ip := make(net.IP, len(parts[0])/2)
+	for i := 0; i < len(ip); i += 4 {
+		var word uint64
+		word, err = strconv.ParseUint(parts[0][i*2:i*2+8], 16, 32)
+		if err != nil {
+			return
+		}
+		binary.LittleEndian.PutUint32(ip[i:], uint32(word))
+	}
+
+	port, err := strconv.ParseUint(parts[1], 16, 16)
 	if err != nil {
-		panic(err)
+		return
 	}
 
-	hidden = !strings.Contains(stdout, addr)
+	addr = formatAddr(ip, uint16(port))
 	return
 }
 
-func hiddenPID(pid int) (hidden bool) {
-	stdout, _, _, err := system("/bin/ps", "-eo", "pid")
+// snapshotAddrs collects local and remote addresses of all sockets
+func snapshotAddrs() (addrs map[string]bool, err error) {
+	addrs = map[string]bool{}
+	for _, proto := range []string{"tcp", "tcp6", "udp", "udp6"} {
+		var file *os.File
+		file, err = os.Open("/proc/net/" + proto)
+		if os.IsNotExist(err) {
+			err = nil
+			continue
+		} else if err != nil {
+			return
+		}
+
+		scanner := bufio.NewScanner(file)
+		scanner.Scan() // header
+		for scanner.Scan() {
+			fields := strings.Fields(scanner.Text())
+			if len(fields) < 3 {
+				continue
+			}
+			for _, field := range fields[1:3] {
+				addr, err := parseProcNetAddr(field)
+				if err == nil {
+					addrs[addr] = true
+				}
+			}
+		}
+		err = scanner.Err()
+		file.Close()
+		if err != nil {
+			return
+		}
+	}
+	return
+}
+
+func takeSnapshot() (snap snapshot, err error) {
+	snap.pids, err = snapshotPIDs()
 	if err != nil {
-		panic(err)
+		return
 	}
 
-	hidden = !strings.Contains(stdout, fmt.Sprintf("%d", pid))
+	snap.addrs, err = snapshotAddrs()
+	if err != nil {
+		return
+	}
+
+	snap.dirs = map[string]map[string]bool{}
 	return
 }
 
-func main() {
-	file, err := os.Open("/proc/rootkiticide")
+func (snap snapshot) hiddenFile(filename string) (hidden bool) {
+	// pipes, anonymous inodes and so on are not in any directory
+	if !filepath.IsAbs(filename) {
+		return false
+	}
+
+	dir := filepath.Dir(filename)
+	names, ok := snap.dirs[dir]
+	if !ok {
+		names = map[string]bool{}
+		list, _ := readNames(dir) // removed directory is empty
+		for _, name := range list {
+			names[name] = true
+		}
+		snap.dirs[dir] = names
+	}
+
+	return !names[filepath.Base(filename)]
+}
+
+func (snap snapshot) hiddenAddr(addr string) (hidden bool) {
+	return !snap.addrs[addr]
+}
+
+func (snap snapshot) hiddenPID(pid int) (hidden bool) {
+	return !snap.pids[pid]
+}
+
+// lruSet keeps the most recently seen objects of one kind, bounded by
+// capacity, and remembers which of them were not verified yet
+type lruSet struct {
+	capacity int
+	order    *list.List
+	items    map[string]*list.Element
+	pending  map[string]bool
+}
+
+type lruItem struct {
+	key      string
+	value    string // e.g. comm of the pid
+	ts       uint64 // of the last event
+	reported bool
+}
+
+func newLRUSet(capacity int) *lruSet {
+	return &lruSet{
+		capacity: capacity,
+		order:    list.New(),
+		items:    map[string]*list.Element{},
+		pending:  map[string]bool{},
+	}
+}
+
+// touch marks new or changed object for verification
+func (l *lruSet) touch(key, value string, ts uint64) {
+	if elem, ok := l.items[key]; ok {
+		l.order.MoveToFront(elem)
+		item := elem.Value.(*lruItem)
+		if ts > item.ts {
+			item.ts = ts
+		}
+		if item.value != value {
+			item.value = value
+			item.reported = false
+			l.pending[key] = true
+		}
+		return
+	}
+
+	l.items[key] = l.order.PushFront(&lruItem{key: key, value: value,
+		ts: ts})
+	l.pending[key] = true
+
+	if l.order.Len() > l.capacity {
+		oldest := l.order.Back()
+		key := oldest.Value.(*lruItem).key
+		l.order.Remove(oldest)
+		delete(l.items, key)
+		delete(l.pending, key)
+	}
+}
+
+// verify checks pending objects in the order of their last events,
+// hidden ones are reported only once, ones with no events since oldest
+// are dropped as stale
+func (l *lruSet) verify(oldest uint64, hidden func(item *lruItem) bool,
+	report func(item *lruItem)) {
+
+	items := make([]*lruItem, 0, len(l.pending))
+	for key := range l.pending {
+		item := l.items[key].Value.(*lruItem)
+		if item.ts >= oldest {
+			items = append(items, item)
+		}
+		delete(l.pending, key)
+	}
+	sort.Slice(items, func(i, j int) bool {
+		return items[i].ts < items[j].ts
+	})
+
+	for _, item := range items {
+		if !item.reported && hidden(item) {
+			item.reported = true
+			report(item)
+		}
+	}
+}
+
+type finding struct {
+	Time   string `json:"time"`
+	TS     uint64 `json:"ts"` // of the last event of the object
+	Kind   string `json:"kind"`
+	Object string `json:"object"`
+	Comm   string `json:"comm,omitempty"`
+	Detail string `json:"detail,omitempty"`
+}
+
+// sampled describes the coverage of the events of a sampling record
+func sampled(entry logEntry) string {
+	return fmt.Sprintf("cpu %d logs 1 in %d events (and the first of "+
+		"a task), %d skipped, load %d.%d%%", entry.CPU, 1<<entry.Level,
+		entry.Skipped, entry.Load/10, entry.Load%10)
+}
+
+// oldestFresh is the timestamp events of fresh objects are not older
+// than, relative to the newest event as the kernel clock is not wall one
+func oldestFresh(newest uint64, maxAge time.Duration) uint64 {
+	if maxAge <= 0 || newest < uint64(maxAge) {
+		return 0
+	}
+	return newest - uint64(maxAge)
+}
+
+// recent objects sorted by their last events
+func recent(objects map[string]logEntry, oldest uint64) (entries []logEntry) {
+	for _, entry := range objects {
+		if entry.TS >= oldest {
+			entries = append(entries, entry)
+		}
+	}
+	sort.Slice(entries, func(i, j int) bool {
+		return entries[i].TS < entries[j].TS
+	})
+	return
+}
+
+// follow reads the binary stream as events arrive and calls tick
+// every interval
+func follow(path string, interval time.Duration, handle func(logEntry),
+	tick func()) (err error) {
+
+	file, err := os.Open(path)
 	if err != nil {
-		panic(err)
+		return
 	}
 	defer file.Close()
+	fd := int(file.Fd())
 
-	reader := bufio.NewReader(file)
+	epfd, err := syscall.EpollCreate1(syscall.EPOLL_CLOEXEC)
+	if err != nil {
+		return
+	}
+	defer syscall.Close(epfd)
 
-	files := map[string]bool{}
-	addrs := map[string]bool{}
-	pids := map[int]string{}
+	event := syscall.EpollEvent{Events: syscall.EPOLLIN, Fd: int32(fd)}
+	err = syscall.EpollCtl(epfd, syscall.EPOLL_CTL_ADD, fd, &event)
+	if err != nil {
+		return
+	}
+
+	le := binary.LittleEndian
+	buf := make([]byte, 1<<20)
+	events := make([]syscall.EpollEvent, 1)
+	header := true
+	next := time.Now().Add(interval)
 
 	for {
-		var line []byte
-		line, err = reader.ReadBytes('\n')
+		for {
+			var n int
+			n, err = syscall.Read(fd, buf)
+			if err != nil {
+				return
+			} else if n == 0 {
+				break
+			}
+
+			records := buf[:n]
+			if header {
+				if n < logStreamHeaderSize ||
+					le.Uint32(records) != logStreamMagic ||
+					le.Uint16(records[4:]) != logStreamVersion {
+					return errors.New("unsupported stream")
+				}
+				records = records[logStreamHeaderSize:]
+				header = false
+			}
+
+			err = decodeRecords(records, handle)
+			if err != nil {
+				return
+			}
+		}
+
+		if !time.Now().Before(next) {
+			tick()
+			next = time.Now().Add(interval)
+		}
+
+		timeout := int(time.Until(next)/time.Millisecond) + 1
+		_, err = syscall.EpollWait(epfd, events, timeout)
+		if err != nil && err != syscall.EINTR {
+			return
+		}
+	}
+}
+
+// runFollow verifies new and changed objects against the system view
+// refreshed every interval and prints findings as JSON lines
+func runFollow(interval time.Duration, capacity int,
+	maxAge time.Duration, capture *captureWriter) (err error) {
+
+	files := newLRUSet(capacity)
+	addrs := newLRUSet(capacity)
+	pids := newLRUSet(capacity)
+	var newest uint64
+
+	encoder := json.NewEncoder(os.Stdout)
+
+	handle := func(entry logEntry) {
+		if entry.TS > newest {
+			newest = entry.TS
+		}
+
+		if capture != nil {
+			if err := capture.add(entry); err != nil {
+				fmt.Fprintln(os.Stderr, err)
+			}
+		}
+
+		switch entry.Type {
+		case "file":
+			files.touch(entry.Filename, "", entry.TS)
+		case "socket":
+			addrs.touch(entry.Saddr, "", entry.TS)
+		case "hidden":
+			// found by the kernel, no need to verify
+			encoder.Encode(finding{
+				Time:   time.Now().Format(time.RFC3339),
+				TS:     entry.TS,
+				Kind:   "hidden process",
+				Object: strconv.Itoa(entry.TGID),
+				Comm:   entry.Comm,
+			})
+			return
+		case "sampling":
+			// events of the hook seen since are partial
+			encoder.Encode(finding{
+				Time:   time.Now().Format(time.RFC3339),
+				TS:     entry.TS,
+				Kind:   "sampling",
+				Object: entry.Hook,
+				Detail: sampled(entry),
+			})
+			return
+		}
+
+		pids.touch(strconv.Itoa(entry.PID), entry.Comm, entry.TS)
+	}
+
+	reporter := func(kind string) func(item *lruItem) {
+		return func(item *lruItem) {
+			encoder.Encode(finding{
+				Time:   time.Now().Format(time.RFC3339),
+				TS:     item.ts,
+				Kind:   kind,
+				Object: item.key,
+				Comm:   item.value,
+			})
+		}
+	}
+
+	tick := func() {
+		if capture != nil {
+			if err := capture.tick(); err != nil {
+				fmt.Fprintln(os.Stderr, err)
+			}
+		}
+
+		snap, err := takeSnapshot()
 		if err != nil {
-			break
+			fmt.Fprintln(os.Stderr, err)
+			return
 		}
-		var entry logEntry
-		json.Unmarshal(line, &entry)
 
-		if entry.Filename != "" {
-			files[entry.Filename] = true
+		oldest := oldestFresh(newest, maxAge)
+
+		files.verify(oldest, func(item *lruItem) bool {
+			return snap.hiddenFile(item.key)
+		}, reporter("file"))
+
+		addrs.verify(oldest, func(item *lruItem) bool {
+			return snap.hiddenAddr(item.key)
+		}, reporter("socket"))
+
+		pids.verify(oldest, func(item *lruItem) bool {
+			pid, _ := strconv.Atoi(item.key)
+			return snap.hiddenPID(pid)
+		}, reporter("process"))
+	}
+
+	return follow("/proc/rootkiticide_bin", interval, handle, tick)
+}
+
+func main() {
+	mmapMode := flag.Bool("mmap", false,
+		"read events in place from /dev/rootkiticide")
+	binaryMode := flag.Bool("binary", false,
+		"read binary records from /proc/rootkiticide_bin")
+	aggregateMode := flag.Bool("aggregate", false,
+		"read distinct objects from /proc/rootkiticide_aggr "+
+			"(rkcd.ko loaded with aggregate=1)")
+	followMode := flag.Bool("follow", false,
+		"run continuously, print findings as JSON lines")
+	interval := flag.Duration("interval", 10*time.Second,
+		"how often to refresh the system view in follow mode")
+	capacity := flag.Int("capacity", 1<<16,
+		"objects of each kind remembered in follow mode")
+	maxAge := flag.Duration("max-age", 10*time.Minute,
+		"skip objects with no events for this long before the newest "+
+			"one (0 - check all)")
+	capturePath := flag.String("capture", "",
+		"also append the events to this capture file")
+	replayPath := flag.String("replay", "",
+		"print the events of this capture file as JSON lines")
+	from := flag.String("from", "",
+		"replay events since this time (RFC3339)")
+	to := flag.String("to", "",
+		"replay events until this time (RFC3339)")
+	pid := flag.Int("pid", 0, "replay events of this pid or tgid")
+	path := flag.String("path", "",
+		"replay events of files with this path prefix")
+	flag.Parse()
+
+	if *replayPath != "" {
+		query := replayQuery{pid: *pid, path: *path}
+		var err error
+		for _, t := range []struct {
+			value string
+			time  *time.Time
+		}{{*from, &query.from}, {*to, &query.to}} {
+			if t.value == "" {
+				continue
+			}
+			if *t.time, err = time.Parse(time.RFC3339, t.value); err != nil {
+				panic(err)
+			}
 		}
 
-		if entry.Saddr != "" {
-			addrs[entry.Saddr] = true
+		encoder := json.NewEncoder(os.Stdout)
+		err = replay(*replayPath, query, func(at time.Time, entry logEntry) {
+			encoder.Encode(struct {
+				Time string `json:"time"`
+				logEntry
+			}{at.Format(time.RFC3339Nano), entry})
+		})
+		if err != nil {
+			panic(err)
 		}
+		return
+	}
 
-		pids[entry.PID] = entry.Comm
+	var capture *captureWriter
+	if *capturePath != "" {
+		var err error
+		if capture, err = openCapture(*capturePath); err != nil {
+			panic(err)
+		}
+		defer capture.close()
 	}
 
-	if err != io.EOF {
+	if *followMode {
+		err := runFollow(*interval, *capacity, *maxAge, capture)
+		if err != nil {
+			panic(err)
+		}
+		return
+	}
+
+	// the last event of every object
+	files := map[string]logEntry{}
+	addrs := map[string]logEntry{}
+	pids := map[string]logEntry{}
+	hiddenPIDs := map[string]logEntry{}
+	var sampling []logEntry
+	var newest uint64
+
+	handle := func(entry logEntry) {
+		if entry.TS > newest {
+			newest = entry.TS
+		}
+
+		if capture != nil {
+			if err := capture.add(entry); err != nil {
+				fmt.Fprintln(os.Stderr, err)
+			}
+		}
+
+		switch entry.Type {
+		case "file":
+			files[entry.Filename] = entry
+		case "socket":
+			addrs[entry.Saddr] = entry
+		case "hidden":
+			hiddenPIDs[strconv.Itoa(entry.TGID)] = entry
+			return
+		case "sampling":
+			sampling = append(sampling, entry)
+			return
+		}
+
+		pids[strconv.Itoa(entry.PID)] = entry
+	}
+
+	var err error
+	if *mmapMode {
+		err = readMmap("/dev/rootkiticide", handle)
+	} else if *binaryMode {
+		err = readBinary("/proc/rootkiticide_bin", handle)
+	} else if *aggregateMode {
+		err = readBinary("/proc/rootkiticide_aggr", handle)
+	} else {
+		err = readJSON("/proc/rootkiticide", handle)
+	}
+	if err != nil {
+		panic(err)
+	}
+
+	snap, err := takeSnapshot()
+	if err != nil {
 		panic(err)
 	}
 
+	oldest := oldestFresh(newest, *maxAge)
+
 	fmt.Println("Hidden files (or already removed):")
-	for file, _ := range files {
-		if hiddenFile(file) {
-			fmt.Println("\t", file)
+	for _, entry := range recent(files, oldest) {
+		if snap.hiddenFile(entry.Filename) {
+			fmt.Println("\t", entry.Filename)
 		}
 	}
 
 	fmt.Println("Hidden connections (or already closed):")
-	for addr, _ := range addrs {
-		if hiddenAddr(addr) {
-			fmt.Println("\t", addr)
+	for _, entry := range recent(addrs, oldest) {
+		if snap.hiddenAddr(entry.Saddr) {
+			fmt.Println("\t", entry.Saddr)
 		}
 	}
 
 	fmt.Println("Hidden processes (or already killed):")
-	for pid, comm := range pids {
-		if hiddenPID(pid) {
-			fmt.Println("\t", pid, comm)
+	for _, entry := range recent(pids, oldest) {
+		if snap.hiddenPID(entry.PID) {
+			fmt.Println("\t", entry.PID, entry.Comm)
+		}
+	}
+
+	// reported by the kernel, so never stale
+	fmt.Println("Hidden processes (found by the kernel):")
+	for _, entry := range recent(hiddenPIDs, 0) {
+		fmt.Println("\t", entry.TGID, entry.Comm, "missing from",
+			missingViews(entry.Missing))
+	}
+
+	fmt.Println("Sampled hooks (the lists above may be incomplete):")
+	for _, entry := range sampling {
+		if entry.TS >= oldest && entry.Skipped != 0 {
+			fmt.Println("\t", entry.Hook, sampled(entry))
 		}
 	}
 
@@ -19,8 +19,65 @@ static int rootkiticide_init(void)
 	if (IS_ERR_VALUE(ret))
 		return ret;
 
+	ret = dev_init();
+	if (IS_ERR_VALUE(ret)) {
+		proc_cleanup();
+		return ret;
+	}
+
+	ret = latency_init();
+	if (IS_ERR_VALUE(ret)) {
+		dev_cleanup();
+		proc_cleanup();
+		return ret;
+	}
+
+	ret = governor_init();
+	if (IS_ERR_VALUE(ret)) {
+		latency_cleanup();
+		dev_cleanup();
+		proc_cleanup();
+		return ret;
+	}
+
+	ret = aggr_init();
+	if (IS_ERR_VALUE(ret)) {
+		governor_cleanup();
+		latency_cleanup();
+		dev_cleanup();
+		proc_cleanup();
+		return ret;
+	}
+
+	ret = filter_init();
+	if (IS_ERR_VALUE(ret)) {
+		aggr_cleanup();
+		governor_cleanup();
+		latency_cleanup();
+		dev_cleanup();
+		proc_cleanup();
+		return ret;
+	}
+
+	ret = control_init();
+	if (IS_ERR_VALUE(ret)) {
+		filter_cleanup();
+		aggr_cleanup();
+		governor_cleanup();
+		latency_cleanup();
+		dev_cleanup();
+		proc_cleanup();
+		return ret;
+	}
+
 	ret = fd_hook_init();
 	if (IS_ERR_VALUE(ret)) {
+		control_cleanup();
+		filter_cleanup();
+		aggr_cleanup();
+		governor_cleanup();
+		latency_cleanup();
+		dev_cleanup();
 		proc_cleanup();
 		return ret;
 	}
@@ -28,6 +85,12 @@ static int rootkiticide_init(void)
 	ret = scheduler_hook_init();
 	if (IS_ERR_VALUE(ret)) {
 		fd_hook_cleanup();
+		control_cleanup();
+		filter_cleanup();
+		aggr_cleanup();
+		governor_cleanup();
+		latency_cleanup();
+		dev_cleanup();
 		proc_cleanup();
 		return ret;
 	}
@@ -41,6 +104,12 @@ static void rootkiticide_exit(void)
 {
 	scheduler_hook_cleanup();
 	fd_hook_cleanup();
+	control_cleanup();
+	filter_cleanup();
+	aggr_cleanup();
+	governor_cleanup();
+	latency_cleanup();
+	dev_cleanup();
 	proc_cleanup();
 	printk("rkcd: cleanup\n");
 }
@@ -10,6 +10,11 @@
 #include <linux/kernel.h>
 #include <linux/perf_event.h>
 #include <linux/net.h>
+#include <linux/poll.h>
+#include <linux/timex.h>
+#include <linux/seq_file.h>
+
+#include "log_entry.h"
 
 #define PROCNAME "rootkiticide"	/* need to be unique per each check */
 
@@ -24,14 +29,110 @@ void fd_hook_cleanup(void);
 /* hw_breakpoint.c */
 struct perf_event * __percpu * __must_check hbp_on_exec(
 	const char *const funcname,
-	const perf_overflow_handler_t handler);
+	const perf_overflow_handler_t handler,
+	void *context);
 void hbp_clear(struct perf_event * __percpu *hbp);
 
 int __must_check is_kernel_address_valid(ulong addr);
 
 /* proc.c */
+extern struct ringbuf_set rbuf;
+extern const struct log_stream_header log_stream_header;
+
 int __must_check proc_init(void);
 void proc_cleanup(void);
-int __must_check log_socket(const struct sockaddr_storage *const saddr);
+uint log_poll(struct file *file, poll_table *wait);
+void log_poll_rearm(void);
+bool __must_check log_seen(const enum log_type type, const void *const object,
+			   const ulong gen, u32 *const cookie);
+int __must_check log_socket(const struct sockaddr_storage *const saddr,
+			    const u32 cookie);
 int __must_check log_process(void);
-int __must_check log_file(const char *const filename);
+int __must_check log_file(const char *const filename, const u32 cookie);
+int __must_check log_hidden(const struct task_struct *const task,
+			    const u8 missing);
+int __must_check log_sampling(const u8 hook, const u8 level,
+			      const u32 skipped, const u32 load);
+int __must_check log_watch(const char *const funcname);
+void log_batch_begin(void);
+void log_batch_end(void);
+
+/* reader.c */
+int __must_check reader_acquire(const struct file *const file,
+				const bool exclusive);
+void reader_release(const struct file *const file, const bool exclusive);
+bool __must_check reader_excluded(void);
+void reader_fork(const struct task_struct *const child);
+void reader_stats(struct seq_file *s);
+
+/* latency.c */
+enum latency_hook {
+	LATENCY_TRY_TO_WAKE_UP,
+	LATENCY_WAKE_UP_NEW_TASK,
+	LATENCY_VFS_WRITE,
+	LATENCY_VFS_WRITEV,
+	LATENCY_WATCH,		/* all of the watches */
+	LATENCY_HOOKS
+};
+
+int __must_check latency_init(void);
+void latency_cleanup(void);
+void latency_record(const enum latency_hook hook, const cycles_t start);
+extern const char *const latency_hook_names[];
+
+/* governor.c */
+int __must_check governor_init(void);
+void governor_cleanup(void);
+void governor_enter(const enum latency_hook hook);
+void governor_exit(const cycles_t start);
+bool __must_check governor_admit(void);
+
+/* crossview.c */
+int __must_check crossview_init(void);
+void crossview_cleanup(void);
+void crossview_seen(struct task_struct *task);
+void crossview_stats(struct seq_file *s);
+
+/* filter.c */
+int __must_check filter_init(void);
+void filter_cleanup(void);
+bool __must_check filter_task(void);
+bool __must_check filter_file(const char *const filename, const size_t len);
+bool __must_check filter_socket(const struct sockaddr_storage *const saddr);
+
+/* aggregate.c */
+extern bool aggregate;
+
+int __must_check aggr_init(void);
+void aggr_cleanup(void);
+int __must_check aggr_process(void);
+int __must_check aggr_file(const char *const filename, const size_t len,
+			   const u32 cookie);
+int __must_check aggr_socket(const struct sockaddr_storage *const saddr,
+			     const size_t len, const u32 cookie);
+void aggr_stats(struct seq_file *s);
+
+/* hook.c */
+struct hook;
+typedef void (*hook_handler_t)(struct pt_regs *regs, void *data);
+
+struct hook * __must_check hook_on_exec(const char *const funcname,
+					const hook_handler_t handler,
+					void *const data,
+					const enum latency_hook latency,
+					const bool no_hbp);
+void hook_clear(struct hook *hook);
+ulong hook_first_arg(const struct pt_regs *regs);
+
+/* control.c */
+int __must_check control_init(void);
+void control_cleanup(void);
+int __must_check control_add(const char *const funcname,
+			     const hook_handler_t handler,
+			     const enum latency_hook latency,
+			     const bool required, const bool no_hbp);
+void control_remove(const char *const funcname);
+
+/* dev.c */
+int __must_check dev_init(void);
+void dev_cleanup(void);
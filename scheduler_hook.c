@@ -8,39 +8,68 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/kallsyms.h>
-#include <linux/perf_event.h>
 #include <linux/delay.h>
 
 #include "rootkiticide.h"
 
-static struct perf_event * __percpu *try_to_wake_up_hbp;
-
 static atomic_t try_to_wake_up_handler_usage = ATOMIC_INIT(0);
-static void try_to_wake_up_handler(struct perf_event *bp,
-				   struct perf_sample_data *data,
-				   struct pt_regs *regs)
+static void try_to_wake_up_handler(struct pt_regs *regs, void *data)
 {
 	atomic_inc(&try_to_wake_up_handler_usage);
-	ulong err = log_process();
-	WARN_ON(err);
+	if (governor_admit())
+		WARN_ON(log_process());
+	/* the task being woken up is the first argument */
+	crossview_seen((struct task_struct *)hook_first_arg(regs));
 	atomic_dec(&try_to_wake_up_handler_usage);
 }
 
+static atomic_t wake_up_new_task_handler_usage = ATOMIC_INIT(0);
+static void wake_up_new_task_handler(struct pt_regs *regs, void *data)
+{
+	atomic_inc(&wake_up_new_task_handler_usage);
+	/* called by the parent with the forked task as first argument */
+	reader_fork((struct task_struct *)hook_first_arg(regs));
+	atomic_dec(&wake_up_new_task_handler_usage);
+}
+
 int scheduler_hook_init(void)
 {
-	/* Set hardware breakpoint on try_to_wake_up */
-	try_to_wake_up_hbp = hbp_on_exec("try_to_wake_up",
-					 try_to_wake_up_handler);
-	if (IS_ERR(try_to_wake_up_hbp))
-		return PTR_ERR(try_to_wake_up_hbp);
+	int ret = crossview_init();
+	if (ret)
+		return ret;
+
+	/* Set hook on try_to_wake_up */
+	/* crossview and the reader trees depend on both, they can't be off */
+	ret = control_add("try_to_wake_up", try_to_wake_up_handler,
+			  LATENCY_TRY_TO_WAKE_UP, true, false);
+	if (ret) {
+		crossview_cleanup();
+		return ret;
+	}
+
+	/*
+	 * Set hook on wake_up_new_task to follow forks of readers. Forks
+	 * are rare enough for a kprobe, the last debug register is left
+	 * to the other users of hardware breakpoints.
+	 */
+	ret = control_add("wake_up_new_task", wake_up_new_task_handler,
+			  LATENCY_WAKE_UP_NEW_TASK, true, true);
+	if (ret) {
+		control_remove("try_to_wake_up");
+		crossview_cleanup();
+		return ret;
+	}
 
 	return 0;
 }
 
 void scheduler_hook_cleanup(void)
 {
-	while (atomic_read(&try_to_wake_up_handler_usage))
+	while (atomic_read(&try_to_wake_up_handler_usage) ||
+	       atomic_read(&wake_up_new_task_handler_usage))
 		msleep_interruptible(100);
 
-	hbp_clear(try_to_wake_up_hbp);
+	control_remove("wake_up_new_task");
+	control_remove("try_to_wake_up");
+	crossview_cleanup();
 }
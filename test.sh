@@ -7,3 +7,46 @@ echo "Check for proc entry contains logs"
 
 echo "Check for proc entry contains valid logs"
 python3 -c 'print('"$(head -n 1 /proc/rootkiticide)"')'
+
+echo "Check for stats entry lists every cpu"
+possible=$(tr , '\n' < /sys/devices/system/cpu/possible \
+	| awk -F- '{ n += NF == 2 ? $2 - $1 + 1 : 1 } END { print n }')
+[ $possible -eq $(awk 'NR > 1 && !NF { exit } NR > 1' /proc/rootkiticide_stats | wc -l) ]
+
+echo "Check for binary stream starts with its header"
+[ rkcb = "$(head -c 4 /proc/rootkiticide_bin)" ]
+
+echo "Check for latency entry has samples of the scheduler hook"
+[ 0 -lt $(awk '$1 == "try_to_wake_up" { print $2; exit }' /proc/rootkiticide_latency) ]
+
+echo "Check for governor budget can be changed at runtime"
+echo 10 > /sys/module/rkcd/parameters/governor_budget
+[ 10 -eq $(cat /sys/module/rkcd/parameters/governor_budget) ]
+echo 5 > /sys/module/rkcd/parameters/governor_budget
+
+echo "Check for writes over the budget are sampled and reported"
+echo 1 > /sys/module/rkcd/parameters/governor_budget
+dd if=/dev/zero of=/dev/null bs=1 count=1000000 2>/dev/null
+echo 5 > /sys/module/rkcd/parameters/governor_budget
+skipped=$(grep -o '"type": "sampling".*"skipped": [0-9]*' /proc/rootkiticide \
+	| sed 's/.*: //' | sort -n | tail -n 1)
+[ 0 -lt ${skipped:-0} ]
+
+echo "Check for filter rules are compiled and shown back"
+echo "path /dev/null" > /proc/rootkiticide_filter
+[ "path /dev/null" = "$(cat /proc/rootkiticide_filter)" ]
+echo > /proc/rootkiticide_filter
+
+echo "Check for hooks can be disarmed and armed back"
+echo "off vfs_writev" > /proc/rootkiticide_hooks
+[ off = "$(awk '$1 == "vfs_writev" { print $2 }' /proc/rootkiticide_hooks)" ]
+echo "on vfs_writev" > /proc/rootkiticide_hooks
+[ on = "$(awk '$1 == "vfs_writev" { print $2 }' /proc/rootkiticide_hooks)" ]
+! echo "off try_to_wake_up" > /proc/rootkiticide_hooks
+[ on = "$(awk '$1 == "try_to_wake_up" { print $2 }' /proc/rootkiticide_hooks)" ]
+
+echo "Check for concurrent readers both get the records"
+head -n 5 /proc/rootkiticide > /tmp/rkcd_reader1 &
+[ 5 -eq $(head -n 5 /proc/rootkiticide | wc -l) ]
+wait
+[ 5 -eq $(wc -l < /tmp/rkcd_reader1) ]